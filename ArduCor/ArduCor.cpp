@@ -36,35 +36,104 @@ const uint8_t  DEFAULT_BAR_SIZE = 2;
 // Constructors
 //================================================================================
 
-ArduCor::ArduCor(uint16_t ledCount)
+ArduCor::CustomColors ArduCor::m_fallback_custom;
+
+ArduCor::ArduCor(uint16_t ledCount, EBufferMode bufferMode, uint16_t pixelCount)
 {
     m_LED_count = ledCount;
     // catch an illegal argument
     if (m_LED_count == 0) {
         m_LED_count = 1;
     }
+    m_pixel_count = pixelCount;
+    if ((m_pixel_count == 0) || (m_pixel_count > m_LED_count)) {
+        m_pixel_count = m_LED_count;
+    }
+    ledCount = m_pixel_count;
+    m_buffer_mode = bufferMode;
+    m_symmetry = eNoSymmetry;
+    m_segment_count = m_pixel_count;
+    m_symmetry_segment_count = m_pixel_count;
+    scaling(eLinear);
+    m_interpolation = 1;
+    m_interpolation_frame = 1;
+    m_key_frame = NULL;
+    m_frame = NULL;
+    m_frame_is_valid = false;
+    m_frame_cache = NULL;
+
+    // allocate the arrays not known at runtime. The indexed buffer modes
+    // store an index for each LED instead of its red, green and blue values.
+    // The routines only compute m_pixel_count LEDs, so that is all that is stored.
+    r_buffer = NULL;
+    g_buffer = NULL;
+    b_buffer = NULL;
+    m_index_buffer = NULL;
+    m_index_colors = NULL;
+    if (m_buffer_mode == eRGBBuffer) {
+        if((r_buffer = (uint8_t*)malloc(ledCount))) {
+            memset(r_buffer, 0, ledCount);
+        }
+
+        if((g_buffer = (uint8_t*)malloc(ledCount))) {
+            memset(g_buffer, 0, ledCount);
+        }
 
-    // allocate the arrays not known at runtime.
-    if((r_buffer = (uint8_t*)malloc(ledCount))) {
-        memset(r_buffer, 0, ledCount);
+        if((b_buffer = (uint8_t*)malloc(ledCount))) {
+            memset(b_buffer, 0, ledCount);
+        }
+    } else {
+        if((m_index_buffer = (uint8_t*)malloc(indexBufferSize()))) {
+            memset(m_index_buffer, 0, indexBufferSize());
+        }
+        // the colors that the indices stand for
+        if((m_index_colors = (Color*)malloc(10 * sizeof(Color)))) {
+            memset(m_index_colors, 0, 10 * sizeof(Color));
+        }
     }
 
-    if((g_buffer = (uint8_t*)malloc(ledCount))) {
-        memset(g_buffer, 0, ledCount);
+    if((m_temp_buffer = (uint8_t*)malloc(tempBufferSize()))) {
+        memset(m_temp_buffer, 0, tempBufferSize());
     }
 
-    if((b_buffer = (uint8_t*)malloc(ledCount))) {
-        memset(b_buffer, 0, ledCount);
+    // the custom colors can be shared with other instances later. Without the memory
+    // for them, the instance shares the fallback colors instead.
+    if((m_custom = (CustomColors*)malloc(sizeof(CustomColors)))) {
+        m_custom->users = 1;
+        m_custom->version = 0;
+    } else {
+        m_custom = &m_fallback_custom;
+        m_custom->users++;
     }
+    m_custom_version = m_custom->version;
 
-    if((m_temp_buffer = (uint8_t*)malloc(ledCount))) {
-        memset(m_temp_buffer, 0, ledCount);
+    // gradients are only allocated once they are used
+    for (x = 0; x < GRADIENT_CACHE_SIZE; ++x) {
+        m_gradients[x] = NULL;
+        m_gradient_palettes[x] = ePalette_MAX;
     }
 
     // all colors gets set before use since it changes each times
     resetToDefaults();
 }
 
+ArduCor::~ArduCor()
+{
+    free(r_buffer);
+    free(g_buffer);
+    free(b_buffer);
+    free(m_index_buffer);
+    free(m_index_colors);
+    free(m_temp_buffer);
+    free(m_key_frame);
+    free(m_frame);
+    frameCache(0);
+    for (x = 0; x < GRADIENT_CACHE_SIZE; ++x) {
+        free(m_gradients[x]);
+    }
+    releaseCustomColors();
+}
+
 void ArduCor::resetToDefaults()
 {
     // By default, this is set to orange. However,
@@ -79,11 +148,10 @@ void ArduCor::resetToDefaults()
     brightness(DEFAULT_BRIGHTNESS);
     m_fade_speed   = DEFAULT_FADE_SPEED;
     m_blink_speed  = DEFAULT_BLINK_SPEED;
-    m_custom_count = DEFAULT_CUSTOM_COUNT;
     m_bar_size     = DEFAULT_BAR_SIZE;
     // edge case for smaller LED arrays, rather than using multiple LEDs in a "bar"
     // it defaults to one LED per bar.
-    if (m_LED_count < 32) {
+    if (m_pixel_count < 32) {
         m_bar_size = 1;
     }
 
@@ -92,24 +160,45 @@ void ArduCor::resetToDefaults()
     m_temp_counter = 0;
     m_temp_bool = true;
     m_temp_color = {0, 0, 0};
+    m_palette = m_custom->colors;
+    m_temp_size = 0;
     m_scale_factor = 0;
     m_temp_float = 0.0f;
     m_temp_step = 0;
     m_temp_goal = 0;
     m_possible_array_color = 0;
     m_is_on = true;
+    // the first routine sets itself up
+    m_preprocess_flag = true;
+    m_index_is_palette = false;
+    if (m_index_colors != NULL) {
+        memset(m_index_colors, 0, 10 * sizeof(Color));
+    }
+    m_is_cycling = false;
 
     // set routine specific variables
     m_goal_color = {0, 0, 0};
+    m_red_diff = 0;
+    m_green_diff = 0;
+    m_blue_diff = 0;
+    m_fade_counter = 0;
+    m_loop_index = 0;
+    m_loop_count = 0;
+    m_repeat_index = 0;
 
-    // set custom colors to default colors
+    // set custom colors to default colors, without changing
+    // the instances that share them.
+    detachCustomColors();
+    m_custom->count = DEFAULT_CUSTOM_COUNT;
     for (x = 0; x < 10; x = x + 5) {
-        m_custom_colors[x]     = {0,   255, 0};     // green
-        m_custom_colors[x + 1] = {125, 0,   255};   // teal
-        m_custom_colors[x + 2] = {0,   0,   255};   // blue
-        m_custom_colors[x + 3] = {40,  127, 40};    // light green
-        m_custom_colors[x + 4] = {60,  0,   160};   // purple
+        m_custom->colors[x]     = {0,   255, 0};     // green
+        m_custom->colors[x + 1] = {125, 0,   255};   // teal
+        m_custom->colors[x + 2] = {0,   0,   255};   // blue
+        m_custom->colors[x + 3] = {40,  127, 40};    // light green
+        m_custom->colors[x + 4] = {60,  0,   160};   // purple
     }
+    m_custom->version++;
+    checkCustomColors();
 }
 
 
@@ -133,12 +222,9 @@ ArduCor::setMainColor(uint8_t r, uint8_t g, uint8_t b)
 void
 ArduCor::setColor(uint16_t colorIndex, uint8_t r, uint8_t g, uint8_t b)
 {
-    if (colorIndex < (sizeof(m_custom_colors) / sizeof(Color))) {
-        m_custom_colors[colorIndex] = {r, g, b};
-        // catch edge case
-        if (m_current_palette == eCustom) {
-            m_preprocess_flag = true;
-        }
+    if (colorIndex < (sizeof(m_custom->colors) / sizeof(Color))) {
+        detachCustomColors();
+        setSharedColor(colorIndex, r, g, b);
     }
 }
 
@@ -147,18 +233,60 @@ void
 ArduCor::setCustomColorCount(uint8_t count)
 {
     if (count != 0) {
-        m_custom_count = count;
-        // catch edge case
-        if (m_current_palette == eCustom) {
-            m_preprocess_flag = true;
-        }
+        detachCustomColors();
+        setSharedCustomColorCount(count);
+    }
+}
+
+void
+ArduCor::setSharedColor(uint16_t colorIndex, uint8_t r, uint8_t g, uint8_t b)
+{
+    if (colorIndex < (sizeof(m_custom->colors) / sizeof(Color))) {
+        m_custom->colors[colorIndex] = {r, g, b};
+        m_custom->version++;
+        checkCustomColors();
+    }
+}
+
+void
+ArduCor::setSharedCustomColorCount(uint8_t count)
+{
+    if (count != 0) {
+        m_custom->count = count;
+        m_custom->version++;
+        checkCustomColors();
+    }
+}
+
+void
+ArduCor::shareCustomColors(ArduCor& other)
+{
+    if (other.m_custom == m_custom) {
+        return;
     }
+    boolean usesCustom = (m_palette == m_custom->colors);
+    releaseCustomColors();
+    m_custom = other.m_custom;
+    m_custom->users++;
+    if (usesCustom) {
+        m_palette = m_custom->colors;
+    }
+    // the colors are most likely different, so treat them as changed. The version is a
+    // uint8_t, so this wraps around and still differs when the version is 0.
+    m_custom_version = m_custom->version - 1;
+    checkCustomColors();
+}
+
+bool
+ArduCor::sharesCustomColors(const ArduCor& other)
+{
+    return (other.m_custom == m_custom);
 }
 
 uint8_t
 ArduCor::customColorCount()
 {
-    return m_custom_count;
+    return m_custom->count;
 }
 
 void
@@ -174,13 +302,77 @@ void
 ArduCor::barSize(uint8_t barSize)
 {
     if ((barSize != 0)
-        && (barSize < m_LED_count)
+        && (barSize < m_pixel_count)
         && (m_bar_size != barSize)) {
         m_bar_size = barSize;
         m_preprocess_flag = true;
     }
 }
 
+void
+ArduCor::symmetry(ESymmetry symmetry, uint8_t repeats)
+{
+    uint16_t segmentCount = m_pixel_count;
+    if ((symmetry == eMirror) && (m_pixel_count > 1)) {
+        // an odd LED in the center is its own mirror
+        segmentCount = (m_pixel_count + 1) / 2;
+    } else if ((symmetry == eRepeat) && (repeats > 1) && (repeats <= m_pixel_count)) {
+        segmentCount = (m_pixel_count + repeats - 1) / repeats;
+    } else {
+        symmetry = eNoSymmetry;
+    }
+    if ((m_symmetry != symmetry)
+        || (m_segment_count != segmentCount)) {
+        m_symmetry = symmetry;
+        m_segment_count = segmentCount;
+        m_symmetry_segment_count = segmentCount;
+        m_preprocess_flag = true;
+    }
+}
+
+void
+ArduCor::scaling(EScaling scaling)
+{
+    m_scaling = scaling;
+    // the distance between the pixels read by neighbouring LEDs, in 16.16 fixed point
+    if (m_pixel_count == m_LED_count) {
+        m_scale_step = 0x10000;
+    } else if (scaling == eLinear) {
+        // the first and the last LED show the first and the last pixel
+        m_scale_step = ((uint32_t)(m_pixel_count - 1) << 16) / (m_LED_count - 1);
+    } else {
+        m_scale_step = ((uint32_t)m_pixel_count << 16) / m_LED_count;
+    }
+}
+
+void
+ArduCor::frameCache(uint32_t maxBytes)
+{
+    if (m_buffer_mode != eRGBBuffer) {
+        maxBytes = 0;
+    }
+    if (maxBytes == 0) {
+        if (m_frame_cache != NULL) {
+            free(m_frame_cache->frames);
+            free(m_frame_cache);
+            m_frame_cache = NULL;
+        }
+        return;
+    }
+    if (m_frame_cache == NULL) {
+        if (!(m_frame_cache = (FrameCache*)malloc(sizeof(FrameCache)))) {
+            return;
+        }
+        memset(m_frame_cache, 0, sizeof(FrameCache));
+    }
+    m_frame_cache->limit = maxBytes;
+    // allocated again on the next update, if the cycle fits
+    free(m_frame_cache->frames);
+    m_frame_cache->frames = NULL;
+    m_frame_cache->frame_count = 0;
+    m_frame_cache->pixel_count = 0;
+}
+
 ArduCor::Color
 ArduCor::mainColor()
 {
@@ -191,18 +383,76 @@ ArduCor::mainColor()
 ArduCor::Color
 ArduCor::color(uint16_t i)
 {
-    if (i < (sizeof(m_custom_colors) / sizeof(Color))) {
-        return m_custom_colors[i];
+    if (i < (sizeof(m_custom->colors) / sizeof(Color))) {
+        return m_custom->colors[i];
     } else {
         return (Color){0,0,0};
     }
 }
 
+ArduCor::Color
+ArduCor::gradientColor(EPalette palette, uint8_t position)
+{
+    Color *gradient = NULL;
+    if (palette < ePalette_MAX) {
+        gradient = paletteGradient(palette);
+    }
+    if (gradient == NULL) {
+        return (Color){0,0,0};
+    }
+    return gradient[position];
+}
+
+ArduCor::Color
+ArduCor::pixelColor(uint16_t i)
+{
+    if ((i >= m_LED_count) || !m_is_on) {
+        return (Color){0,0,0};
+    }
+    if (m_scale_step == 0x10000) {
+        return storedColor(segmentIndex(i));
+    }
+    return scaledColor((uint32_t)i * m_scale_step);
+}
+
+void
+ArduCor::pixelColors(uint16_t start, uint16_t count, Color *colors)
+{
+    // the position of the first LED in the pixels, after that each LED is an add
+    uint32_t position = (uint32_t)start * m_scale_step;
+    // the pixels the last LED fell between, which neighbouring LEDs usually share
+    uint16_t pixel = m_pixel_count;
+    Color color = {0, 0, 0};
+    Color next = {0, 0, 0};
+    for (x = 0; x < count; ++x) {
+        if (((uint32_t)start + x >= m_LED_count) || !m_is_on) {
+            colors[x] = (Color){0,0,0};
+        } else if (m_scale_step == 0x10000) {
+            colors[x] = storedColor(segmentIndex(start + x));
+        } else {
+            if ((position >> 16) != pixel) {
+                pixel = position >> 16;
+                color = storedColor(segmentIndex(pixel));
+                next = (pixel + 1 < m_pixel_count) ? storedColor(segmentIndex(pixel + 1)) : color;
+            }
+            if (m_scaling == eLinear) {
+                colors[x] = blendColors(color, next, (uint8_t)(position >> 8));
+            } else {
+                colors[x] = color;
+            }
+        }
+        position += m_scale_step;
+    }
+}
+
 uint8_t
 ArduCor::red(uint16_t i)
 {
+    if ((m_buffer_mode != eRGBBuffer) || (m_scale_step != 0x10000) || m_frame_is_valid) {
+        return pixelColor(i).red;
+    }
     if ((i < m_LED_count) && m_is_on) {
-        return r_buffer[i];
+        return r_buffer[segmentIndex(i)];
     } else {
         return 0;
     }
@@ -211,8 +461,11 @@ ArduCor::red(uint16_t i)
 uint8_t
 ArduCor::green(uint16_t i)
 {
+    if ((m_buffer_mode != eRGBBuffer) || (m_scale_step != 0x10000) || m_frame_is_valid) {
+        return pixelColor(i).green;
+    }
     if ((i < m_LED_count) && m_is_on) {
-        return g_buffer[i];
+        return g_buffer[segmentIndex(i)];
     } else {
         return 0;
     }
@@ -221,8 +474,11 @@ ArduCor::green(uint16_t i)
 uint8_t
 ArduCor::blue(uint16_t i)
 {
+    if ((m_buffer_mode != eRGBBuffer) || (m_scale_step != 0x10000) || m_frame_is_valid) {
+        return pixelColor(i).blue;
+    }
     if ((i < m_LED_count) && m_is_on) {
-        return b_buffer[i];
+        return b_buffer[segmentIndex(i)];
     } else {
         return 0;
     }
@@ -237,6 +493,12 @@ ArduCor::blue(uint16_t i)
 void
 ArduCor::preProcess(ERoutine routine, EPalette palette)
 {
+    // the routine is about to change the LEDs
+    m_frame_is_valid = false;
+
+    // another instance may have changed the custom colors
+    checkCustomColors();
+
     // prevent illegal values
     if (palette >= ePalette_MAX) {
         palette = (EPalette)((uint8_t)ePalette_MAX - 1);
@@ -253,6 +515,12 @@ ArduCor::preProcess(ERoutine routine, EPalette palette)
                                           m_temp_color.blue);
     }
 
+    // LEDs were drawn past the symmetry, so the routine starts over with it
+    if (m_segment_count != m_symmetry_segment_count) {
+        m_segment_count = m_symmetry_segment_count;
+        m_preprocess_flag = true;
+    }
+
     //---------
     // Routine Has Changed
     //---------
@@ -276,6 +544,8 @@ ArduCor::preProcess(ERoutine routine, EPalette palette)
 
         // reset flag
         m_preprocess_flag = false;
+        // the routine starts over, maybe with different frames
+        invalidateFrameCache();
         // reset the temps
         m_temp_index = 0;
         m_temp_counter = 0;
@@ -297,7 +567,11 @@ ArduCor::preProcess(ERoutine routine, EPalette palette)
         }
         if (routine == eSingleWave) {
             m_temp_index = 0;
-            m_temp_float = m_LED_count / (2 * m_bar_size);
+            m_temp_float = m_segment_count / (2 * m_bar_size);
+            if (m_temp_float < 1) {
+                // fewer LEDs than two bars still get a single step of the wave
+                m_temp_float = 1;
+            }
             movingBufferSetup(m_temp_float, m_bar_size, 1);
         }
         if (routine == eSingleSawtoothFade) {
@@ -311,22 +585,30 @@ ArduCor::preProcess(ERoutine routine, EPalette palette)
 void
 ArduCor::setupPalette(EPalette palette)
 {
-    // Set up the m_temp_array used for the multi color routines
-    // This is done by copying the relevant colors into the
-    // m_temp_array and storing the number of colors in m_temp_size.
+    // Set up the m_palette used for the multi color routines
+    // and store the number of colors in m_temp_size. Only presets
+    // on AVR boards get copied, into m_temp_array.
+    m_temp_size = paletteSize(palette);
+    m_palette = paletteColors(palette, m_temp_array);
+}
+
+uint8_t
+ArduCor::paletteSize(EPalette palette)
+{
     if (palette == eCustom) {
-        m_temp_size = m_custom_count;
-        memcpy(m_temp_array, m_custom_colors, sizeof(m_custom_colors));
-    } else {
-        // For our PROGMEM we aimed to have as small of footprint as possible.
-        // We currently store a 2D array of color palettes, and another array of
-        // the sizes of those palettes groups. First we grab the size, then we copy
-        // the buffer directly from the 2D array.
-        m_temp_size = pgm_read_word_near(presetSizes + palette - 1);
-        memcpy_P(m_temp_array,
-                (void*)pgm_read_word_near(colorPresets + palette - 1),
-                (m_temp_size * 3));
+        // the custom array only holds 10 colors
+        return (m_custom->count < 10) ? m_custom->count : 10;
+    }
+    return presetSize(palette);
+}
+
+const ArduCor::Color*
+ArduCor::paletteColors(EPalette palette, Color *buffer)
+{
+    if (palette == eCustom) {
+        return m_custom->colors;
     }
+    return presetColors(palette, buffer);
 }
 
 
@@ -343,6 +625,178 @@ ArduCor::turnOff()
     m_is_on = false;
 }
 
+bool
+ArduCor::copyState(const ArduCor& other)
+{
+    if ((other.m_LED_count != m_LED_count)
+        || (other.m_pixel_count != m_pixel_count)
+        || (other.m_buffer_mode != m_buffer_mode)
+        || (other.m_interpolation != m_interpolation)) {
+        return false;
+    }
+    if (&other == this) {
+        return true;
+    }
+    // share the custom colors, either one gets its own copy once it changes them
+    if (other.m_custom != m_custom) {
+        releaseCustomColors();
+        m_custom = other.m_custom;
+        m_custom->users++;
+    }
+    m_custom_version = other.m_custom_version;
+    if (other.m_custom_version != m_custom->version) {
+        // the custom colors changed since other last saw them, wrapping around like the version
+        m_custom_version = m_custom->version - 1;
+    }
+    invalidateGradient(eCustom);
+    // the cached frames may be of a different routine
+    invalidateFrameCache();
+
+    // the palette may be a copy in the other instance's m_temp_array
+    memcpy(m_temp_array, other.m_temp_array, sizeof(m_temp_array));
+    if (other.m_palette == other.m_temp_array) {
+        m_palette = m_temp_array;
+    } else {
+        m_palette = other.m_palette;
+    }
+    m_current_routine = other.m_current_routine;
+    m_current_palette = other.m_current_palette;
+    m_main_color = other.m_main_color;
+    m_symmetry = other.m_symmetry;
+    m_segment_count = other.m_segment_count;
+    m_symmetry_segment_count = other.m_symmetry_segment_count;
+    m_scaling = other.m_scaling;
+    m_scale_step = other.m_scale_step;
+
+    // the LEDs
+    if (m_buffer_mode == eRGBBuffer) {
+        memcpy(r_buffer, other.r_buffer, m_pixel_count);
+        memcpy(g_buffer, other.g_buffer, m_pixel_count);
+        memcpy(b_buffer, other.b_buffer, m_pixel_count);
+    } else {
+        memcpy(m_index_buffer, other.m_index_buffer, indexBufferSize());
+    }
+    if (m_index_colors != NULL) {
+        memcpy(m_index_colors, other.m_index_colors, 10 * sizeof(Color));
+    }
+    m_index_is_palette = other.m_index_is_palette;
+    m_is_cycling = other.m_is_cycling;
+    if (m_interpolation > 1) {
+        memcpy(m_key_frame, other.m_key_frame, m_pixel_count * sizeof(Color));
+        memcpy(m_frame, other.m_frame, m_pixel_count * sizeof(Color));
+        m_interpolation_frame = other.m_interpolation_frame;
+        m_frame_is_valid = other.m_frame_is_valid;
+    }
+
+    // settings
+    m_bar_size = other.m_bar_size;
+    m_bright_level = other.m_bright_level;
+    m_fade_speed = other.m_fade_speed;
+    m_blink_speed = other.m_blink_speed;
+    m_brightness_flag = other.m_brightness_flag;
+    m_preprocess_flag = other.m_preprocess_flag;
+    m_is_on = other.m_is_on;
+
+    // the progress of the routine
+    memcpy(m_temp_buffer, other.m_temp_buffer, tempBufferSize());
+    m_temp_counter = other.m_temp_counter;
+    m_temp_index = other.m_temp_index;
+    m_temp_bool = other.m_temp_bool;
+    m_temp_color = other.m_temp_color;
+    m_temp_size = other.m_temp_size;
+    m_temp_goal = other.m_temp_goal;
+    m_temp_step = other.m_temp_step;
+    m_temp_float = other.m_temp_float;
+    m_goal_color = other.m_goal_color;
+    m_red_diff = other.m_red_diff;
+    m_green_diff = other.m_green_diff;
+    m_blue_diff = other.m_blue_diff;
+    m_fade_counter = other.m_fade_counter;
+    m_loop_index = other.m_loop_index;
+    m_loop_count = other.m_loop_count;
+    m_scale_factor = other.m_scale_factor;
+    m_repeat_index = other.m_repeat_index;
+    m_possible_array_color = other.m_possible_array_color;
+    return true;
+}
+
+bool
+ArduCor::hasSameState(const ArduCor& other)
+{
+    if ((other.m_LED_count != m_LED_count)
+        || (other.m_pixel_count != m_pixel_count)
+        || (other.m_buffer_mode != m_buffer_mode)
+        || (other.m_interpolation != m_interpolation)) {
+        return false;
+    }
+    // the colors of the routines
+    if ((m_custom->count != other.m_custom->count)
+        || memcmp(m_custom->colors, other.m_custom->colors, sizeof(m_custom->colors))
+        || (m_temp_size != other.m_temp_size)
+        || memcmp(m_palette, other.m_palette, ((m_temp_size < 10) ? m_temp_size : 10) * sizeof(Color))
+        || (m_current_routine != other.m_current_routine)
+        || (m_current_palette != other.m_current_palette)
+        || memcmp(&m_main_color, &other.m_main_color, sizeof(Color))
+        || (m_symmetry != other.m_symmetry)
+        || (m_segment_count != other.m_segment_count)
+        || (m_symmetry_segment_count != other.m_symmetry_segment_count)
+        || (m_scaling != other.m_scaling)
+        || (m_scale_step != other.m_scale_step)) {
+        return false;
+    }
+    // the LEDs
+    if (m_buffer_mode == eRGBBuffer) {
+        if (memcmp(r_buffer, other.r_buffer, m_pixel_count)
+            || memcmp(g_buffer, other.g_buffer, m_pixel_count)
+            || memcmp(b_buffer, other.b_buffer, m_pixel_count)) {
+            return false;
+        }
+    } else if (memcmp(m_index_buffer, other.m_index_buffer, indexBufferSize())) {
+        return false;
+    }
+    if (((m_index_colors != NULL) && memcmp(m_index_colors, other.m_index_colors, 10 * sizeof(Color)))
+        || (m_index_is_palette != other.m_index_is_palette)
+        || (m_is_cycling != other.m_is_cycling)) {
+        return false;
+    }
+    // the blended frame follows from the keyframes, the phase and the brightness
+    if ((m_interpolation > 1)
+        && ((m_interpolation_frame != other.m_interpolation_frame)
+            || (m_frame_is_valid != other.m_frame_is_valid)
+            || memcmp(m_key_frame, other.m_key_frame, m_pixel_count * sizeof(Color)))) {
+        return false;
+    }
+    // settings
+    if ((m_bar_size != other.m_bar_size)
+        || (m_bright_level != other.m_bright_level)
+        || (m_fade_speed != other.m_fade_speed)
+        || (m_blink_speed != other.m_blink_speed)
+        || (m_brightness_flag != other.m_brightness_flag)
+        || (m_preprocess_flag != other.m_preprocess_flag)
+        || (m_is_on != other.m_is_on)) {
+        return false;
+    }
+    // the progress of the routine
+    return !memcmp(m_temp_buffer, other.m_temp_buffer, tempBufferSize())
+           && (m_temp_counter == other.m_temp_counter)
+           && (m_temp_index == other.m_temp_index)
+           && (m_temp_bool == other.m_temp_bool)
+           && !memcmp(&m_temp_color, &other.m_temp_color, sizeof(Color))
+           && (m_temp_goal == other.m_temp_goal)
+           && (m_temp_step == other.m_temp_step)
+           && (m_temp_float == other.m_temp_float)
+           && !memcmp(&m_goal_color, &other.m_goal_color, sizeof(Color))
+           && (m_red_diff == other.m_red_diff)
+           && (m_green_diff == other.m_green_diff)
+           && (m_blue_diff == other.m_blue_diff)
+           && (m_fade_counter == other.m_fade_counter)
+           && (m_loop_index == other.m_loop_index)
+           && (m_loop_count == other.m_loop_count)
+           && (m_scale_factor == other.m_scale_factor)
+           && (m_repeat_index == other.m_repeat_index)
+           && (m_possible_array_color == other.m_possible_array_color);
+}
+
 void ArduCor::turnOn() {
     if (!m_is_on) {
       fillColorBuffers(m_temp_color.red, m_temp_color.green, m_temp_color.blue);
@@ -386,21 +840,41 @@ void
 ArduCor::singleWave(uint8_t red, uint8_t green, uint8_t blue)
 {
     preProcess(eSingleWave, m_current_palette);
+    if (m_buffer_mode != eRGBBuffer) {
+        // the LEDs are stored as shades of the color
+        m_index_is_palette = false;
+        m_index_colors[0] = {red, green, blue};
+    }
+    if ((m_frame_cache != NULL)
+        && ((m_frame_cache->color.red != red)
+            || (m_frame_cache->color.green != green)
+            || (m_frame_cache->color.blue != blue))) {
+        invalidateFrameCache();
+        m_frame_cache->color = {red, green, blue};
+    }
+    if (readCachedFrame()) {
+        m_brightness_flag = false;
+        m_temp_index = (m_temp_index + 1) % m_loop_index;
+        return;
+    }
     m_repeat_index = 0;
-    // loop through all the values between 0 and m_loop_index m_loop_count times.
-    for (x = 0; x < (m_loop_count * m_loop_index); ++x) {
-        // if we are computing values above m_LED_count, ignore.
-        if (x < m_LED_count) {
-            // m_temp_counter holds the index in this instance of a repeat through
-            // the looped values.
-            m_temp_counter = (m_repeat_index + m_temp_index) % m_loop_index;
+    // loop through the values between 0 and m_loop_index until every LED is computed. On long
+    // strips, m_loop_count * m_loop_index can be more than x counts to, so stop at the LEDs.
+    for (x = 0; x < m_segment_count; ++x) {
+        // m_temp_counter holds the index in this instance of a repeat through
+        // the looped values.
+        m_temp_counter = (m_repeat_index + m_temp_index) % m_loop_index;
+        if (m_buffer_mode == eRGBBuffer) {
             r_buffer[x] = (uint8_t)(red * (m_temp_buffer[m_temp_counter] / m_temp_float));
             g_buffer[x] = (uint8_t)(green * (m_temp_buffer[m_temp_counter] / m_temp_float));
             b_buffer[x] = (uint8_t)(blue * (m_temp_buffer[m_temp_counter] / m_temp_float));
-            // if a loop is pushing a repeat_index over m_loop_index, go back to 0
-            m_repeat_index = (x + 1) % m_loop_index;
+        } else {
+            writeIndex(x, (uint8_t)(255 * (m_temp_buffer[m_temp_counter] / m_temp_float)));
         }
+        // if a loop is pushing a repeat_index over m_loop_index, go back to 0
+        m_repeat_index = (x + 1) % m_loop_index;
     }
+    writeCachedFrame();
     m_brightness_flag = false;
     m_temp_index = (m_temp_index + 1) % m_loop_index;
 }
@@ -413,15 +887,19 @@ ArduCor::singleGlimmer(uint8_t red, uint8_t green, uint8_t blue, uint8_t percent
     // set all LEDs to the base color before applying glimmer
     // to a subsection of them.
     fillColorBuffers(red, green, blue);
-    for (x = 0; x < m_LED_count; ++x) {
+    for (x = 0; x < m_segment_count; ++x) {
         // a random number is generated. If its less than the percent,
         // treat this as an LED that gets a glimmer effect
         if (random(1,101) < percent && percent != 0) {
             // set a random level for the LED to be dimmed by.
             m_scale_factor = (uint8_t)random(2,7);
-            r_buffer[x] = red / m_scale_factor;
-            g_buffer[x] = green / m_scale_factor;
-            b_buffer[x] = blue / m_scale_factor;
+            if (m_buffer_mode == eRGBBuffer) {
+                r_buffer[x] = red / m_scale_factor;
+                g_buffer[x] = green / m_scale_factor;
+                b_buffer[x] = blue / m_scale_factor;
+            } else {
+                writeIndex(x, 255 / m_scale_factor);
+            }
         }
     }
     m_brightness_flag = false;
@@ -501,15 +979,17 @@ ArduCor::multiGlimmer(EPalette palette, uint8_t percent)
     preProcess(eMultiGlimmer, palette);
     // set all LEDs to the base color before applying glimmer
     // to a subsection of them.
-    fillColorBuffers(m_temp_array[0].red,
-                     m_temp_array[0].green,
-                     m_temp_array[0].blue);
-    for (x = 0; x < m_LED_count; ++x) {
+    fillColorBuffers(m_palette[0].red,
+                     m_palette[0].green,
+                     m_palette[0].blue);
+    setupPaletteIndices();
+    for (x = 0; x < m_segment_count; ++x) {
         if (random(1,101) < percent && percent != 0) {
-            // m_temp_color is set in chooseRandomFromArray
-            chooseRandomFromArray(m_temp_array, m_temp_size, true);
+            // m_temp_color and m_temp_index are set in chooseRandomFromArray
+            chooseRandomFromArray(m_palette, m_temp_size, true);
         } else {
-            m_temp_color = m_temp_array[0];
+            m_temp_color = m_palette[0];
+            m_temp_index = 0;
         }
 
         // a random number is generated, if its less than the percent,
@@ -517,14 +997,10 @@ ArduCor::multiGlimmer(EPalette palette, uint8_t percent)
         if (random(1,101) < percent && percent != 0) {
             // chooses how much to divide the input by
             m_scale_factor = (uint8_t)random(2,7);
-            r_buffer[x] = m_temp_color.red / m_scale_factor;
-            g_buffer[x] = m_temp_color.green / m_scale_factor;
-            b_buffer[x] = m_temp_color.blue / m_scale_factor;
         } else {
-            r_buffer[x] = m_temp_color.red;
-            g_buffer[x] = m_temp_color.green;
-            b_buffer[x] = m_temp_color.blue;
+            m_scale_factor = 1;
         }
+        drawPaletteColor(x, m_temp_index, m_scale_factor);
     }
 }
 
@@ -539,15 +1015,15 @@ ArduCor::multiFade(EPalette palette)
         if (m_temp_size > 1) {
             m_fade_counter = 0;
             m_temp_counter = (m_temp_counter + 1) % m_temp_size;
-            m_temp_color = m_temp_array[m_temp_counter];
-            m_goal_color = m_temp_array[(m_temp_counter + 1) % m_temp_size];
+            m_temp_color = m_palette[m_temp_counter];
+            m_goal_color = m_palette[(m_temp_counter + 1) % m_temp_size];
             m_red_diff   = m_temp_color.red - m_goal_color.red;
             m_green_diff = m_temp_color.green - m_goal_color.green;
             m_blue_diff  = m_temp_color.blue - m_goal_color.blue;
         } else {
             m_temp_counter = 0;
-            m_goal_color = m_temp_array[0];
-            m_temp_color = m_temp_array[0];
+            m_goal_color = m_palette[0];
+            m_temp_color = m_palette[0];
             m_red_diff = 0;
             m_green_diff = 0;
             m_blue_diff = 0;
@@ -569,7 +1045,7 @@ ArduCor::multiRandomSolid(EPalette palette)
 {
     preProcess(eMultiRandomSolid, palette);
     if (!(m_temp_counter % m_blink_speed)) {
-        chooseRandomFromArray(m_temp_array, m_temp_size, true);
+        chooseRandomFromArray(m_palette, m_temp_size, true);
         fillColorBuffers(m_temp_color.red, m_temp_color.green, m_temp_color.blue);
         // always apply the brightness after an update
         m_brightness_flag = true;
@@ -581,13 +1057,12 @@ void
 ArduCor::multiRandomIndividual(EPalette palette)
 {
     preProcess(eMultiRandomIndividual, palette);
-    for (x = 0; x < m_LED_count; ++x) {
-        // chooses a random color from m_temp_array
-        chooseRandomFromArray(m_temp_array, m_temp_size, true);
+    setupPaletteIndices();
+    for (x = 0; x < m_segment_count; ++x) {
+        // chooses a random color from m_palette
+        chooseRandomFromArray(m_palette, m_temp_size, true);
         // draws the random color to the buffer.
-        r_buffer[x] = m_temp_color.red;
-        g_buffer[x] = m_temp_color.green;
-        b_buffer[x] = m_temp_color.blue;
+        drawPaletteColor(x, m_temp_index);
     }
 }
 
@@ -595,25 +1070,69 @@ void
 ArduCor::multiBars(EPalette palette, uint8_t barSizeSetting)
 {
     barSize(barSizeSetting);
+    if (m_is_cycling) {
+        // multiBarsCycle uses the same buffers differently, so start over
+        m_is_cycling = false;
+        m_preprocess_flag = true;
+    }
     preProcess(eMultiBars, palette);
+    setupPaletteIndices();
+    if (readCachedFrame()) {
+        m_temp_index = (m_temp_index + 1) % m_loop_index;
+        return;
+    }
     m_repeat_index = 0;
-    // loop through all the values between 0 and m_loop_index m_loop_count times.
-    for (x = 0; x < (m_loop_count * m_loop_index); ++x) {
-        // if we are computing values above m_LED_count, ignore.
-        if (x < m_LED_count) {
-            // m_temp_counter holds the index in this instance of a repeat through
-            // the looped values.
-            m_temp_counter = (m_repeat_index + m_temp_index) % m_loop_index;
-            r_buffer[x] = m_temp_array[m_temp_buffer[m_temp_counter]].red;
-            g_buffer[x] = m_temp_array[m_temp_buffer[m_temp_counter]].green;
-            b_buffer[x] = m_temp_array[m_temp_buffer[m_temp_counter]].blue;
-            // if a loop is pushing a repeat_index over m_loop_index, go back to 0
-            m_repeat_index = (x + 1) % m_loop_index;
-        }
+    // loop through the values between 0 and m_loop_index until every LED is computed.
+    for (x = 0; x < m_segment_count; ++x) {
+        // m_temp_counter holds the index in this instance of a repeat through
+        // the looped values.
+        m_temp_counter = (m_repeat_index + m_temp_index) % m_loop_index;
+        drawPaletteColor(x, m_temp_buffer[m_temp_counter]);
+        // if a loop is pushing a repeat_index over m_loop_index, go back to 0
+        m_repeat_index = (x + 1) % m_loop_index;
     }
+    writeCachedFrame();
     m_temp_index = (m_temp_index + 1) % m_loop_index;
 }
 
+void
+ArduCor::multiBarsCycle(EPalette palette, uint8_t barSizeSetting, uint8_t blendSteps)
+{
+    barSize(barSizeSetting);
+    if (!m_is_cycling) {
+        m_is_cycling = true;
+        m_preprocess_flag = true;
+    }
+    if (blendSteps == 0) {
+        blendSteps = 1;
+    }
+    preProcess(eMultiBars, palette);
+    // m_temp_index counts the updates through a full rotation of the palette
+    m_temp_index = m_temp_index % (m_temp_size * blendSteps);
+    if (m_buffer_mode == eRGBBuffer) {
+        // the RGB buffers have no index colors, so the rotated palette is only needed here
+        Color colors[10];
+        rotatePalette(m_temp_index, blendSteps, colors);
+        for (x = 0; x < m_segment_count; ++x) {
+            m_temp_color = colors[m_temp_buffer[x % m_loop_index]];
+            r_buffer[x] = m_temp_color.red;
+            g_buffer[x] = m_temp_color.green;
+            b_buffer[x] = m_temp_color.blue;
+        }
+    } else {
+        rotatePalette(m_temp_index, blendSteps, m_index_colors);
+        if (m_temp_bool) {
+            // the bars only need to be drawn once, after that only the palette changes
+            m_temp_bool = false;
+            m_index_is_palette = true;
+            for (x = 0; x < m_segment_count; ++x) {
+                writeIndex(x, m_temp_buffer[x % m_loop_index]);
+            }
+        }
+    }
+    m_temp_index++;
+}
+
 //================================================================================
 // Post-Processing
 //================================================================================
@@ -621,6 +1140,21 @@ ArduCor::multiBars(EPalette palette, uint8_t barSizeSetting)
 void
 ArduCor::applyBrightness()
 {
+    if (m_interpolation > 1) {
+        // the keyframes are never dimmed, so single color routines use full brightness
+        uint16_t level = (m_current_routine > eSingleSawtoothFade) ? m_bright_level : 100;
+        // the weights of the previous and the new keyframe, out of 256, with brightness applied
+        uint16_t fraction = ((uint16_t)m_interpolation_frame << 8) / m_interpolation;
+        uint16_t keyWeight = ((256 - fraction) * level) / 100;
+        uint16_t newWeight = (fraction * level) / 100;
+        for (x = 0; x < m_segment_count; ++x) {
+            m_frame[x].red = (uint8_t)((m_key_frame[x].red * keyWeight + r_buffer[x] * newWeight) >> 8);
+            m_frame[x].green = (uint8_t)((m_key_frame[x].green * keyWeight + g_buffer[x] * newWeight) >> 8);
+            m_frame[x].blue = (uint8_t)((m_key_frame[x].blue * keyWeight + b_buffer[x] * newWeight) >> 8);
+        }
+        m_frame_is_valid = true;
+        return;
+    }
     //  brightness is required
     if (m_brightness_flag && m_is_on) {
         // if brightness is only needed once, unset the flag
@@ -629,8 +1163,18 @@ ArduCor::applyBrightness()
             || (m_current_routine == eMultiRandomSolid)) {
             m_brightness_flag = false;
         }
+        if (m_buffer_mode != eRGBBuffer) {
+            // only the colors that the indices stand for need to be dimmed
+            uint8_t colorCount = m_index_is_palette ? m_temp_size : 1;
+            for (x = 0; x < colorCount; ++x) {
+                m_index_colors[x].red = (uint8_t)((m_index_colors[x].red * (uint16_t)m_bright_level) / 100);
+                m_index_colors[x].green = (uint8_t)((m_index_colors[x].green * (uint16_t)m_bright_level) / 100);
+                m_index_colors[x].blue = (uint8_t)((m_index_colors[x].blue * (uint16_t)m_bright_level) / 100);
+            }
+            return;
+        }
         // loop again to apply global effects
-        for(x = 0; x < m_LED_count; ++x) {
+        for(x = 0; x < m_segment_count; ++x) {
             // Since this is expensive and often run on every LED update, we avoid
             // floating point calculations for a bit of a speed increase.
             r_buffer[x] = (uint8_t)((r_buffer[x] * (uint16_t)m_bright_level) / 100);
@@ -645,7 +1189,20 @@ bool
 ArduCor::drawColor(uint16_t i, uint8_t red, uint8_t green, uint8_t blue)
 {
     // checks if its valid draw
-    if (i < m_LED_count) {
+    if ((i < m_LED_count) && (m_buffer_mode == eRGBBuffer)) {
+        m_frame_is_valid = false;
+        if (m_segment_count != m_pixel_count) {
+            // copy the LEDs across the symmetry, so each LED has its own pixel. Every copy
+            // reads from the first segment, which stays the same.
+            for (x = m_segment_count; x < m_pixel_count; ++x) {
+                r_buffer[x] = r_buffer[segmentIndex(x)];
+                g_buffer[x] = g_buffer[segmentIndex(x)];
+                b_buffer[x] = b_buffer[segmentIndex(x)];
+            }
+            m_segment_count = m_pixel_count;
+        }
+        // the pixel that the LED shows
+        i = ((uint32_t)i * m_scale_step) >> 16;
         r_buffer[i] = red;
         g_buffer[i] = green;
         b_buffer[i] = blue;
@@ -654,6 +1211,61 @@ ArduCor::drawColor(uint16_t i, uint8_t red, uint8_t green, uint8_t blue)
     return false;
 }
 
+bool
+ArduCor::frameInterpolation(uint8_t frames)
+{
+    if (frames <= 1) {
+        free(m_key_frame);
+        free(m_frame);
+        m_key_frame = NULL;
+        m_frame = NULL;
+        m_interpolation = 1;
+        m_frame_is_valid = false;
+        return true;
+    }
+    if (m_buffer_mode != eRGBBuffer) {
+        return false;
+    }
+    if (m_key_frame == NULL) {
+        m_key_frame = (Color*)malloc(m_pixel_count * sizeof(Color));
+        m_frame = (Color*)malloc(m_pixel_count * sizeof(Color));
+        if ((m_key_frame == NULL) || (m_frame == NULL)) {
+            free(m_key_frame);
+            free(m_frame);
+            m_key_frame = NULL;
+            m_frame = NULL;
+            return false;
+        }
+    }
+    // blend from the LEDs as they are, until the next keyframe
+    for (x = 0; x < m_pixel_count; ++x) {
+        m_key_frame[x] = (Color){r_buffer[x], g_buffer[x], b_buffer[x]};
+    }
+    m_interpolation = frames;
+    // the next frame is a keyframe
+    m_interpolation_frame = frames;
+    m_frame_is_valid = false;
+    return true;
+}
+
+bool
+ArduCor::nextFrame(bool showKeyframe)
+{
+    if (m_interpolation <= 1) {
+        return true;
+    }
+    if (showKeyframe || (m_interpolation_frame >= m_interpolation)) {
+        // the LEDs of the last update become the keyframe that the next one blends from
+        for (x = 0; x < m_segment_count; ++x) {
+            m_key_frame[x] = (Color){r_buffer[x], g_buffer[x], b_buffer[x]};
+        }
+        m_interpolation_frame = showKeyframe ? m_interpolation : 1;
+        return true;
+    }
+    m_interpolation_frame++;
+    return false;
+}
+
 //================================================================================
 // Helper Functions
 //================================================================================
@@ -661,16 +1273,16 @@ ArduCor::drawColor(uint16_t i, uint8_t red, uint8_t green, uint8_t blue)
 void
 ArduCor::movingBufferSetup(uint16_t colorCount, uint8_t groupSize, uint8_t startingValue)
 {
-    if ((groupSize * colorCount) > m_LED_count) {
+    if ((groupSize * colorCount) > m_segment_count) {
         // edge case handled for memory reasons, a full loop must
-        // take less than the m_LED_count
+        // take less than the LEDs that are computed
         groupSize = 1;
     }
     // minimum number of values needed for a looping pattern.
     m_loop_index = groupSize * colorCount;
     // minimum number of times we need to loop these values to
     // completely fill the LEDs.
-    m_loop_count = ((m_LED_count / m_loop_index) + 1);
+    m_loop_count = ((m_segment_count / m_loop_index) + 1);
     // change the starting value for routines like singleWave
     if (startingValue < colorCount) {
         m_temp_index = startingValue;
@@ -696,13 +1308,330 @@ ArduCor::movingBufferSetup(uint16_t colorCount, uint8_t groupSize, uint8_t start
 void
 ArduCor::fillColorBuffers(uint8_t r, uint8_t g, uint8_t b)
 {
-    memset(r_buffer, r, m_LED_count);
-    memset(g_buffer, g, m_LED_count);
-    memset(b_buffer, b, m_LED_count);
+    if (m_buffer_mode != eRGBBuffer) {
+        // every LED is the full shade of the color
+        m_index_is_palette = false;
+        m_index_colors[0] = {r, g, b};
+        memset(m_index_buffer, 0xFF, indexBufferSize());
+        return;
+    }
+    m_frame_is_valid = false;
+    memset(r_buffer, r, m_segment_count);
+    memset(g_buffer, g, m_segment_count);
+    memset(b_buffer, b, m_segment_count);
+}
+
+bool
+ArduCor::readCachedFrame()
+{
+    if (m_frame_cache == NULL) {
+        return false;
+    }
+    FrameCache *cache = m_frame_cache;
+    if ((cache->frame_count != m_loop_index) || (cache->pixel_count != m_segment_count)) {
+        // a different cycle, allocate it if it fits
+        free(cache->frames);
+        cache->frames = NULL;
+        cache->frame_count = m_loop_index;
+        cache->pixel_count = m_segment_count;
+        uint32_t size = (uint32_t)m_loop_index * (3 * (uint32_t)m_segment_count + 1);
+        if (size <= cache->limit) {
+            cache->frames = (uint8_t*)malloc(size);
+            invalidateFrameCache();
+        }
+    }
+    uint16_t frame = m_temp_index % m_loop_index;
+    if ((cache->frames == NULL) || !cache->frames[frame]) {
+        cache->misses++;
+        return false;
+    }
+    cache->hits++;
+    m_frame_is_valid = false;
+    uint8_t *pixels = cache->frames + cache->frame_count + (uint32_t)frame * 3 * cache->pixel_count;
+    memcpy(r_buffer, pixels, cache->pixel_count);
+    memcpy(g_buffer, pixels + cache->pixel_count, cache->pixel_count);
+    memcpy(b_buffer, pixels + 2 * cache->pixel_count, cache->pixel_count);
+    // the values the loop over the LEDs ends with
+    m_repeat_index = (m_segment_count - 1) % m_loop_index;
+    m_temp_counter = (m_repeat_index + m_temp_index) % m_loop_index;
+    m_repeat_index = m_segment_count % m_loop_index;
+    x = m_segment_count;
+    return true;
+}
+
+void
+ArduCor::writeCachedFrame()
+{
+    if ((m_frame_cache == NULL) || (m_frame_cache->frames == NULL)) {
+        return;
+    }
+    FrameCache *cache = m_frame_cache;
+    uint16_t frame = m_temp_index % m_loop_index;
+    uint8_t *pixels = cache->frames + cache->frame_count + (uint32_t)frame * 3 * cache->pixel_count;
+    memcpy(pixels, r_buffer, cache->pixel_count);
+    memcpy(pixels + cache->pixel_count, g_buffer, cache->pixel_count);
+    memcpy(pixels + 2 * cache->pixel_count, b_buffer, cache->pixel_count);
+    cache->frames[frame] = 1;
+}
+
+void
+ArduCor::invalidateFrameCache()
+{
+    if ((m_frame_cache != NULL) && (m_frame_cache->frames != NULL)) {
+        memset(m_frame_cache->frames, 0, m_frame_cache->frame_count);
+    }
+}
+
+void
+ArduCor::setupPaletteIndices()
+{
+    if (m_buffer_mode != eRGBBuffer) {
+        m_index_is_palette = true;
+        memcpy(m_index_colors, m_palette, m_temp_size * sizeof(Color));
+    }
+}
+
+void
+ArduCor::drawPaletteColor(uint16_t i, uint8_t paletteIndex, uint8_t divisor)
+{
+    if (m_buffer_mode == eRGBBuffer) {
+        r_buffer[i] = m_palette[paletteIndex].red / divisor;
+        g_buffer[i] = m_palette[paletteIndex].green / divisor;
+        b_buffer[i] = m_palette[paletteIndex].blue / divisor;
+    } else {
+        writeIndex(i, ((divisor - 1) << 4) | paletteIndex);
+    }
+}
+
+void
+ArduCor::rotatePalette(uint16_t step, uint8_t blendSteps, Color *colors)
+{
+    uint8_t rotation = step / blendSteps;
+    uint8_t blend = step % blendSteps;
+    for (x = 0; x < m_temp_size; ++x) {
+        m_temp_color = m_palette[(x + rotation) % m_temp_size];
+        m_goal_color = m_palette[(x + rotation + 1) % m_temp_size];
+        colors[x].red = m_temp_color.red + ((int32_t)(m_goal_color.red - m_temp_color.red) * blend) / blendSteps;
+        colors[x].green = m_temp_color.green + ((int32_t)(m_goal_color.green - m_temp_color.green) * blend) / blendSteps;
+        colors[x].blue = m_temp_color.blue + ((int32_t)(m_goal_color.blue - m_temp_color.blue) * blend) / blendSteps;
+    }
+    m_index_is_palette = true;
+}
+
+ArduCor::Color*
+ArduCor::paletteGradient(EPalette palette)
+{
+    checkCustomColors();
+    // these are local since a routine may call this in the middle of a loop over x
+    uint8_t slot = 0;
+    while ((slot < GRADIENT_CACHE_SIZE)
+           && ((m_gradients[slot] == NULL) || (m_gradient_palettes[slot] != palette))) {
+        slot++;
+    }
+    if (slot == GRADIENT_CACHE_SIZE) {
+        // not cached, so compute it in the least recently used slot
+        slot = GRADIENT_CACHE_SIZE - 1;
+        if (m_gradients[slot] == NULL) {
+            m_gradients[slot] = (Color*)malloc(256 * sizeof(Color));
+            if (m_gradients[slot] == NULL) {
+                return NULL;
+            }
+        }
+        Color buffer[10];
+        const Color *colors = paletteColors(palette, buffer);
+        uint8_t colorCount = paletteSize(palette);
+        Color *gradient = m_gradients[slot];
+        for (uint16_t i = 0; i < 256; ++i) {
+            // fixed point position in the palette, the integer part is in the high byte
+            // and the fraction is in the low byte.
+            uint16_t position = i * colorCount;
+            Color start = colors[position >> 8];
+            Color end = colors[((position >> 8) + 1) % colorCount];
+            uint16_t blend = position & 0xFF;
+            gradient[i].red = (start.red * (256 - blend) + end.red * blend) >> 8;
+            gradient[i].green = (start.green * (256 - blend) + end.green * blend) >> 8;
+            gradient[i].blue = (start.blue * (256 - blend) + end.blue * blend) >> 8;
+        }
+        m_gradient_palettes[slot] = palette;
+    }
+    // move it to the front, so the last slot is always the least recently used
+    Color *gradient = m_gradients[slot];
+    for (; slot > 0; --slot) {
+        m_gradients[slot] = m_gradients[slot - 1];
+        m_gradient_palettes[slot] = m_gradient_palettes[slot - 1];
+    }
+    m_gradients[0] = gradient;
+    m_gradient_palettes[0] = palette;
+    return gradient;
+}
+
+void
+ArduCor::invalidateGradient(EPalette palette)
+{
+    for (uint8_t slot = 0; slot < GRADIENT_CACHE_SIZE; ++slot) {
+        if (m_gradient_palettes[slot] == palette) {
+            // move it to the back, so it is the next slot that gets reused
+            Color *gradient = m_gradients[slot];
+            for (; slot < GRADIENT_CACHE_SIZE - 1; ++slot) {
+                m_gradients[slot] = m_gradients[slot + 1];
+                m_gradient_palettes[slot] = m_gradient_palettes[slot + 1];
+            }
+            m_gradients[slot] = gradient;
+            m_gradient_palettes[slot] = ePalette_MAX;
+            return;
+        }
+    }
+}
+
+void
+ArduCor::detachCustomColors()
+{
+    if (m_custom->users > 1) {
+        // if there isn't enough memory for a copy, the shared colors get changed instead
+        CustomColors *colors = (CustomColors*)malloc(sizeof(CustomColors));
+        if (colors != NULL) {
+            memcpy(colors, m_custom, sizeof(CustomColors));
+            colors->users = 1;
+            m_custom->users--;
+            if (m_palette == m_custom->colors) {
+                m_palette = colors->colors;
+            }
+            m_custom = colors;
+        }
+    }
+}
+
+void
+ArduCor::releaseCustomColors()
+{
+    m_custom->users--;
+    if ((m_custom->users == 0) && (m_custom != &m_fallback_custom)) {
+        free(m_custom);
+    }
+}
+
+void
+ArduCor::checkCustomColors()
+{
+    if (m_custom_version != m_custom->version) {
+        m_custom_version = m_custom->version;
+        invalidateGradient(eCustom);
+        // catch edge case
+        if (m_current_palette == eCustom) {
+            m_preprocess_flag = true;
+        }
+    }
+}
+
+uint16_t
+ArduCor::indexBufferSize()
+{
+    if (m_buffer_mode == ePackedIndexedBuffer) {
+        return (m_pixel_count + 1) / 2;
+    }
+    return m_pixel_count;
+}
+
+uint16_t
+ArduCor::tempBufferSize()
+{
+    // a bar of each color of the largest palette needs 10 bytes, even with fewer LEDs
+    if (m_pixel_count < 10) {
+        return 10;
+    }
+    return m_pixel_count;
+}
+
+void
+ArduCor::writeIndex(uint16_t i, uint8_t index)
+{
+    if (m_buffer_mode == eIndexedBuffer) {
+        m_index_buffer[i] = index;
+        return;
+    }
+    // palette indices only need their low 4 bits, shades keep their top 4 bits
+    uint8_t nibble = m_index_is_palette ? (index & 0x0F) : (index >> 4);
+    if (i & 1) {
+        m_index_buffer[i >> 1] = (m_index_buffer[i >> 1] & 0x0F) | (nibble << 4);
+    } else {
+        m_index_buffer[i >> 1] = (m_index_buffer[i >> 1] & 0xF0) | nibble;
+    }
+}
+
+uint8_t
+ArduCor::readIndex(uint16_t i)
+{
+    if (m_buffer_mode == eIndexedBuffer) {
+        return m_index_buffer[i];
+    }
+    uint8_t nibble = (i & 1) ? (m_index_buffer[i >> 1] >> 4) : (m_index_buffer[i >> 1] & 0x0F);
+    // a shade of 15 is stretched to 255, so the full shade is the full color
+    return m_index_is_palette ? nibble : (uint8_t)(nibble * 17);
+}
+
+ArduCor::Color
+ArduCor::storedColor(uint16_t i)
+{
+    if (m_frame_is_valid) {
+        return m_frame[i];
+    }
+    if (m_buffer_mode == eRGBBuffer) {
+        return (Color){r_buffer[i], g_buffer[i], b_buffer[i]};
+    }
+    uint8_t index = readIndex(i);
+    if (m_index_is_palette) {
+        Color color = m_index_colors[(index & 0x0F) % 10];
+        uint8_t divisor = (index >> 4) + 1;
+        if (divisor > 1) {
+            color.red = color.red / divisor;
+            color.green = color.green / divisor;
+            color.blue = color.blue / divisor;
+        }
+        return color;
+    }
+    // a shade of 255 is the full color, and the multiply and shift is cheaper than a division
+    return (Color){(uint8_t)((m_index_colors[0].red * (uint16_t)(index + 1)) >> 8),
+                   (uint8_t)((m_index_colors[0].green * (uint16_t)(index + 1)) >> 8),
+                   (uint8_t)((m_index_colors[0].blue * (uint16_t)(index + 1)) >> 8)};
+}
+
+ArduCor::Color
+ArduCor::scaledColor(uint32_t position)
+{
+    uint16_t i = position >> 16;
+    Color color = storedColor(segmentIndex(i));
+    if ((m_scaling == eLinear) && (i + 1 < m_pixel_count)) {
+        color = blendColors(color, storedColor(segmentIndex(i + 1)), (uint8_t)(position >> 8));
+    }
+    return color;
+}
+
+ArduCor::Color
+ArduCor::blendColors(Color from, Color to, uint8_t fraction)
+{
+    // a fraction of 0 is all from, and each step moves 1/256 of the way to to
+    uint16_t remainder = 256 - fraction;
+    return (Color){(uint8_t)((from.red * remainder + to.red * (uint16_t)fraction) >> 8),
+                   (uint8_t)((from.green * remainder + to.green * (uint16_t)fraction) >> 8),
+                   (uint8_t)((from.blue * remainder + to.blue * (uint16_t)fraction) >> 8)};
+}
+
+uint16_t
+ArduCor::segmentIndex(uint16_t i)
+{
+    if (m_symmetry == eMirror) {
+        // the second half is the first half reversed
+        if (i >= m_segment_count) {
+            return m_pixel_count - 1 - i;
+        }
+    } else if (m_symmetry == eRepeat) {
+        return i % m_segment_count;
+    }
+    return i;
 }
 
 void
-ArduCor::chooseRandomFromArray(Color *array, uint8_t max_index, boolean canRepeat)
+ArduCor::chooseRandomFromArray(const Color *array, uint8_t max_index, boolean canRepeat)
 {
     m_possible_array_color = random(0, max_index);
     if (!canRepeat && max_index > 2) {
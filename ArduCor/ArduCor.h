@@ -4,6 +4,12 @@
 #include "Arduino.h"
 #include "ArduCorProtocols.h"
 
+// how many palette gradients are kept at once. Each one allocates 768 bytes the first
+// time it is used.
+#ifndef GRADIENT_CACHE_SIZE
+#define GRADIENT_CACHE_SIZE 2
+#endif
+
 /*!
  * \version v3.0.0
  * \date April 14, 2018
@@ -58,6 +64,15 @@
  * these in your `loop()` function and then put a delay between updates. This delay will
  * be used to determine how fast the LED's blink.
  *
+ * To fit more LEDs in the memory of a small board, such as an Uno, the library can store
+ * an index for each LED instead of its color:
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~
+ * ArduCor routines = ArduCor(LED_COUNT, ArduCor::eIndexedBuffer);
+ * ~~~~~~~~~~~~~~~~~~~~~
+ *
+ * The colors are then looked up when they are read with `pixelColor()`, `red()`, `green()`
+ * or `blue()`. See `EBufferMode` for what each mode supports.
  *
  */
 class ArduCor
@@ -76,15 +91,89 @@ public:
         uint8_t blue;
     };
 
+    /*!
+     * \enum EBufferMode How the library stores the LEDs.
+     */
+    enum EBufferMode
+    {
+        /*!
+         * Stores the red, green and blue value of each LED. Supports every routine and `drawColor()`.
+         */
+        eRGBBuffer,
+        /*!
+         * Stores a byte for each LED. Multi color routines other than multiFade store the index
+         * of the LED's color in the palette, and multiGlimmer stores how much the LED is dimmed
+         * with it. Other routines store a shade of a single color, so singleWave and singleGlimmer
+         * can be one step of 255 brighter or darker than with eRGBBuffer. `drawColor()` isn't supported.
+         */
+        eIndexedBuffer,
+        /*!
+         * Stores half a byte for each LED. The same as eIndexedBuffer, except that multiGlimmer
+         * doesn't dim LEDs, and there are 16 shades of a single color instead of 256.
+         */
+        ePackedIndexedBuffer
+    };
+
+    /*!
+     * \enum ESymmetry How the routines are copied across the LEDs. With a symmetry, the routines
+     * only compute the first part of the LEDs, and the getters read the rest from it.
+     */
+    enum ESymmetry
+    {
+        /*!
+         * Every LED is computed.
+         */
+        eNoSymmetry,
+        /*!
+         * The first half of the LEDs is computed, and the second half shows it reversed,
+         * so the routines are mirrored around the center of the LEDs.
+         */
+        eMirror,
+        /*!
+         * The first LEDs are computed and repeated a number of times, such as around a ring.
+         */
+        eRepeat
+    };
+
+    /*!
+     * \enum EScaling How the LEDs are read from the pixels when there are fewer pixels than LEDs.
+     */
+    enum EScaling
+    {
+        /*!
+         * Each LED shows the pixel it falls on, so each pixel is shown by a run of LEDs.
+         */
+        eNearest,
+        /*!
+         * Each LED blends the two pixels it falls between, so the runs fade into each other.
+         */
+        eLinear
+    };
+
     /*!
      * Required constructor. The library should be stored in
      * global memory and allocated only once at startup.
      *
-     * It will allocate `4 * ledCount` bytes.
+     * It will allocate `4 * pixelCount` bytes with eRGBBuffer, `2 * pixelCount` bytes with
+     * eIndexedBuffer and `1.5 * pixelCount` bytes with ePackedIndexedBuffer, and 33 bytes for
+     * the custom colors, which are freed if it uses shareCustomColors().
+     *
+     * For long strips, the routines can compute fewer pixels than there are LEDs. The getters
+     * then stretch the pixels across the LEDs, see scaling(). This takes less memory and time,
+     * and suits routines like multiFade, singleWave and the glimmers that don't need a
+     * different value for every LED.
      *
      * \param ledCount number of individual RGB LEDs.
+     * \param bufferMode how the LEDs are stored.
+     * \param pixelCount number of pixels the routines compute. 0 computes every LED.
      */
-    ArduCor(uint16_t ledCount);
+    ArduCor(uint16_t ledCount, EBufferMode bufferMode = eRGBBuffer, uint16_t pixelCount = 0);
+
+    /*!
+     * Frees the LED buffers, the cached gradients and frames, and the custom colors once no
+     * other instance shares them.
+     */
+    ~ArduCor();
 
     /*!
      * Resets all internal values to the original values.
@@ -102,6 +191,23 @@ public:
      */
     void turnOff();
 
+    /*!
+     * Continues from the state of another instance, so that both show the same LEDs and
+     * the same updates from then on. This copies the settings, the current routine and how
+     * far it has gotten, and the LEDs, and shares the custom colors.
+     *
+     * \param other the instance to copy. It must have the same number of LEDs and buffer mode.
+     * \return true if the state was copied, false if the instances don't match.
+     */
+    bool copyState(const ArduCor& other);
+
+    /*!
+     * Returns true if this instance has the same settings, custom colors, routine progress
+     * and LEDs as another instance. Two such instances show the same LEDs after the same
+     * updates, except for routines that use random numbers.
+     */
+    bool hasSameState(const ArduCor& other);
+
     //================================================================================
     // Getters and Setters
     //================================================================================
@@ -133,6 +239,34 @@ public:
      */
     void setCustomColorCount(uint8_t count);
 
+    /*!
+     * Uses the same custom colors as another instance instead of its own, which saves the
+     * memory of the custom colors for each instance that shares them. setColor() and
+     * setCustomColorCount() still only change this instance, by giving it its own copy of the
+     * custom colors first. setSharedColor() and setSharedCustomColorCount() change them for
+     * every instance that shares them at once.
+     *
+     * \param other the instance to share the custom colors of.
+     */
+    void shareCustomColors(ArduCor& other);
+
+    /*!
+     * Returns true if this instance uses the same custom colors as another instance.
+     */
+    bool sharesCustomColors(const ArduCor& other);
+
+    /*!
+     * Set the color in the custom color array at the provided index, for this instance and
+     * every instance that shares its custom colors.
+     */
+    void setSharedColor(uint16_t colorIndex, uint8_t r, uint8_t g, uint8_t b);
+
+    /*!
+     * Sets the amount of colors used in custom multi color routines, for this instance and
+     * every instance that shares its custom colors.
+     */
+    void setSharedCustomColorCount(uint8_t count);
+
     /*!
      * Returns true if the LEDs are on, false if they are off.
      */
@@ -155,6 +289,62 @@ public:
      */
     int brightness() { return m_bright_level; }
 
+    /*!
+     * Sets how the routines are copied across the LEDs. The routines then only compute the
+     * LEDs that aren't copies, so they take less time and draw fewer random numbers, and start
+     * over on their next update.
+     *
+     * \param symmetry how the LEDs are copied.
+     * \param repeats how many times eRepeat repeats the LEDs, between 2 and the number of LEDs.
+     */
+    void symmetry(ESymmetry symmetry, uint8_t repeats = 2);
+
+    /*!
+     * Retrieve how the routines are copied across the LEDs.
+     */
+    ESymmetry symmetry() { return m_symmetry; }
+
+    /*!
+     * Sets how the LEDs are read from the pixels when the instance computes fewer pixels than
+     * there are LEDs. eLinear is the default. The symmetry applies to the pixels.
+     */
+    void scaling(EScaling scaling);
+
+    /*!
+     * Retrieve how the LEDs are read from the pixels.
+     */
+    EScaling scaling() { return m_scaling; }
+
+    /*!
+     * Lets singleWave and multiBars keep the frames of their cycle, so that after their first
+     * cycle each update is a copy instead of a computation. The cache takes 3 bytes for each
+     * pixel that the routines compute and 1 byte per frame of the cycle, and routines whose
+     * cycle doesn't fit in maxBytes are computed as usual. It starts over whenever the
+     * routine, its palette, color, bar size or the symmetry changes.
+     *
+     * Only eRGBBuffer supports it, and it is off by default.
+     *
+     * \param maxBytes the most memory the cache may take, 0 turns it off.
+     */
+    void frameCache(uint32_t maxBytes);
+
+    /*!
+     * Retrieve the most memory the frame cache may take, 0 if it is off.
+     */
+    uint32_t frameCache() { return m_frame_cache ? m_frame_cache->limit : 0; }
+
+    /*!
+     * Retrieve the number of updates of singleWave and multiBars that were copied from the
+     * frame cache.
+     */
+    uint32_t frameCacheHits() { return m_frame_cache ? m_frame_cache->hits : 0; }
+
+    /*!
+     * Retrieve the number of updates of singleWave and multiBars that were computed while
+     * the frame cache is on.
+     */
+    uint32_t frameCacheMisses() { return m_frame_cache ? m_frame_cache->misses : 0; }
+
     /*!
      * Retrieve the main color, which is used for single color routines.
      */
@@ -165,6 +355,38 @@ public:
      */
     Color color(uint16_t i);
 
+    /*!
+     * Retrieve the color of the LED at a given index in the buffer. In the indexed buffer modes,
+     * this looks up the color once instead of once for each of `red()`, `green()` and `blue()`.
+     */
+    Color pixelColor(uint16_t i);
+
+    /*!
+     * Retrieve the colors of a range of LEDs, the same as calling `pixelColor()` for each one.
+     * When there are fewer pixels than LEDs, the position of each LED in the pixels is found
+     * with a single fixed point add instead of a multiply.
+     *
+     * \param start the index of the first LED.
+     * \param count the number of LEDs.
+     * \param colors filled with the color of each LED, must hold count colors.
+     */
+    void pixelColors(uint16_t start, uint16_t count, Color *colors);
+
+    /*!
+     * Retrieve a color from a smooth gradient through the colors of a palette. The gradient
+     * has 256 steps and wraps around, so the last color blends back into the first.
+     *
+     * The gradient is computed once and cached, and later calls are a single lookup. The
+     * `GRADIENT_CACHE_SIZE` most recently used palettes are kept, and each one takes 768
+     * bytes. Changing the custom colors recomputes the eCustom gradient on its next use.
+     *
+     * \param palette the palette to use. eCustom is the custom array, all other values are
+     *        preset groups.
+     * \param position where in the gradient the color is, between 0 and 255.
+     * \return the color, or black if there isn't enough memory for the gradient.
+     */
+    Color gradientColor(EPalette palette, uint8_t position);
+
     /*!
      * Retrieve the r value at a given index in the buffer.
      */
@@ -327,6 +549,24 @@ public:
      */
     void multiBars(EPalette palette, uint8_t barSizeSetting);
 
+    /*!
+     * Shows the same bars as multiBars, but moves them by rotating the colors of the palette
+     * through the bars instead of moving the bars. With the indexed buffer modes, the bars are
+     * only drawn when the routine or palette changes, and each update only changes the
+     * palette, so an update takes the same time no matter how many LEDs there are.
+     *
+     * With a blendSteps of 1, each update moves the colors one bar, which matches every
+     * barSize-th update of multiBars. With more blendSteps, the colors blend into the next
+     * bar's color over that many updates. A blendSteps equal to the bar size moves the colors
+     * at the same speed as multiBars.
+     *
+     * \param palette the palette to use for the routine. eCustom is the custom array,
+     *        all other values are preset groups.
+     * \param barSize how many LEDs before switching to the other bar.
+     * \param blendSteps how many updates it takes for a color to move to the next bar.
+     */
+    void multiBarsCycle(EPalette palette, uint8_t barSizeSetting, uint8_t blendSteps = 1);
+
     /*! @} */
     //================================================================================
     // Post Processing
@@ -341,31 +581,86 @@ public:
      * This function takes the brightness() value given to the routines object and applies
      * it to every LED. Relatively speaking, this is a pretty expensive operation so it is
      * left optional.
+     *
+     * With frameInterpolation(), this also blends the frame from the last two keyframes, in
+     * the same pass over the LEDs. It must then be called for every frame, even at full
+     * brightness.
      */
     void applyBrightness();
 
     /*!
-     * Attempts to draw the color provided on the index provided.
+     * Shows each routine update over a number of frames, by blending from the previous update
+     * to the new one. The routine then only needs to be called for every `frames`-th frame,
+     * which nextFrame() tells. The frames trail the routine by one update.
+     *
+     * Only eRGBBuffer supports it. It allocates 6 bytes for each pixel while it is on.
+     *
+     * \param frames how many frames each update is shown over. 1 turns interpolation off.
+     * \return true if it is set, false if the buffer mode doesn't support it or there
+     *         isn't enough memory.
+     */
+    bool frameInterpolation(uint8_t frames);
+
+    /*!
+     * Retrieve how many frames each routine update is shown over.
+     */
+    uint8_t frameInterpolation() { return m_interpolation; }
+
+    /*!
+     * Starts the next frame. Call it before each frame, and call the routine if it returns true,
+     * followed by applyBrightness() either way. Always true without frameInterpolation().
+     *
+     * \param showKeyframe if true, the next update of the routine is shown right away
+     *        instead of being blended in, such as for a routine that is paused.
+     * \return true if the routine should be updated for this frame.
+     */
+    bool nextFrame(bool showKeyframe = false);
+
+    /*!
+     * Attempts to draw the color provided on the index provided. With a symmetry, the first draw
+     * copies the LEDs across the symmetry, so that every LED can be drawn on its own, such as
+     * for frames streamed from a server. The next routine update starts over with the symmetry.
      *
      * \param i the index of the LED that you want to change. Must be less than the total
      *        amount of LEDs or else it will return false.
      * \param red the new red value of the LED, between 0 and 255.
      * \param green the new green value of the LED, between 0 and 255.
      * \param blue the new blue value of the LED, between 0 and 255.
-     * \return true if index exists and the color was drawn, false otherwise.
+     * \return true if index exists and the color was drawn, false otherwise. Always false in
+     *         the indexed buffer modes.
      */
     bool drawColor(uint16_t i, uint8_t red, uint8_t green, uint8_t blue);
 
     /*! @} */
 private:
 
-    // used by multi color routines to store their colors.
+    // an instance owns its buffers, so it can't be copied. See copyState().
+    ArduCor(const ArduCor&);
+    ArduCor& operator=(const ArduCor&);
+
+    // the colors used by multi color routines. Points to the custom colors, a preset or
+    // m_temp_array.
+    const Color *m_palette;
+    // used to store the colors of a preset on boards that keep presets in program memory.
     Color    m_temp_array[10];
-    // stores the user's settings for custom colors.
-    Color    m_custom_colors[10];
-    // stores how many colors from the custom colors array should
-    // be used in a routine.
-    uint8_t  m_custom_count;
+    // the custom colors, which can be shared by several instances.
+    struct CustomColors
+    {
+        // stores the user's settings for custom colors.
+        Color   colors[10];
+        // stores how many colors from the custom colors array should
+        // be used in a routine.
+        uint8_t count;
+        // the number of instances using these colors. 16 bits, since a host can run hundreds.
+        uint16_t users;
+        // changes each time the colors or count change
+        uint8_t version;
+    };
+    CustomColors *m_custom;
+    // shared by the instances that couldn't allocate their own custom colors. It is never freed.
+    static CustomColors m_fallback_custom;
+    // the version of m_custom that the routines last saw
+    uint8_t  m_custom_version;
 
     // these variables are checked in every preproces step
     ERoutine  m_current_routine;
@@ -379,8 +674,64 @@ private:
     uint8_t *g_buffer;
     uint8_t *b_buffer;
 
+    // how the LEDs are stored
+    EBufferMode m_buffer_mode;
+    // buffer used for storing an index for each LED in the indexed buffer modes
+    uint8_t *m_index_buffer;
+    // the colors that the indices stand for, with brightness applied. 10 colors, only
+    // allocated in the indexed buffer modes.
+    Color   *m_index_colors;
+    // true if the indices are palette indices, false if they are shades of m_index_colors[0]
+    boolean  m_index_is_palette;
+    // true if the bars were last drawn by multiBarsCycle instead of multiBars
+    boolean  m_is_cycling;
+
+    // cached palette gradients, from the most to the least recently used
+    Color   *m_gradients[GRADIENT_CACHE_SIZE];
+    // the palette of each cached gradient, ePalette_MAX if it is out of date
+    EPalette m_gradient_palettes[GRADIENT_CACHE_SIZE];
+
     // settings and stored values
     uint16_t m_LED_count;
+    // how many pixels the routines compute, at most m_LED_count
+    uint16_t m_pixel_count;
+    // how the LEDs are read from the pixels
+    EScaling m_scaling;
+    // the distance between the pixels of neighbouring LEDs in 16.16 fixed point, 1.0 if
+    // there is a pixel for each LED
+    uint32_t m_scale_step;
+    // how many frames each routine update is shown over, 1 if frames aren't interpolated
+    uint8_t  m_interpolation;
+    // the frames shown since the last keyframe, up to m_interpolation
+    uint8_t  m_interpolation_frame;
+    // the previous keyframe, and the blended frame that the getters read, when interpolating
+    Color   *m_key_frame;
+    Color   *m_frame;
+    // true if m_frame shows the current routine
+    boolean  m_frame_is_valid;
+    struct FrameCache
+    {
+        // the frames of the cycle of the current routine, after a byte for each frame that
+        // is 1 once the frame is stored. NULL if the cycle doesn't fit.
+        uint8_t *frames;
+        // the most bytes frames may take
+        uint32_t limit;
+        // the frames in the cycle and the pixels in each frame of frames
+        uint16_t frame_count;
+        uint16_t pixel_count;
+        // the color that singleWave's cached frames are drawn with
+        Color    color;
+        uint32_t hits;
+        uint32_t misses;
+    };
+    // only allocated while the frame cache is on, so it costs a pointer otherwise
+    FrameCache *m_frame_cache;
+    // how the pixels are copied, and how many of them the routines compute
+    ESymmetry m_symmetry;
+    uint16_t m_segment_count;
+    // the LEDs the routines compute with m_symmetry. drawColor sets m_segment_count to every
+    // pixel until the next update of a routine.
+    uint16_t m_symmetry_segment_count;
     uint16_t m_bar_size;
     uint16_t m_bright_level;
     uint8_t  m_fade_speed;
@@ -428,12 +779,62 @@ private:
 
     /*!
      * Called by preprocessing if the the palette has changed. This sets up the
-     * m_temp_array and m_temp_size with the relevant data from the color palette.
+     * m_palette and m_temp_size with the relevant data from the color palette.
      *
      * \palette the new palette that is getting used by the routines.
      */
     void setupPalette(EPalette palette);
 
+    /*!
+     * Retrieve the number of colors in a palette.
+     *
+     * \param palette the palette to count.
+     */
+    uint8_t paletteSize(EPalette palette);
+
+    /*!
+     * Retrieve the colors of a palette. Presets are only copied into the buffer on boards
+     * that keep them in program memory, otherwise they are read in place.
+     *
+     * \param palette the palette to read.
+     * \param buffer a buffer that can hold 10 colors.
+     * \return the colors of the palette.
+     */
+    const Color* paletteColors(EPalette palette, Color *buffer);
+
+    /*!
+     * Finds the cached gradient of a palette, computing it in place of the least recently
+     * used gradient if it isn't cached, and marks it as the most recently used.
+     *
+     * \param palette the palette of the gradient.
+     * \return the 256 colors of the gradient, or NULL if it couldn't be allocated.
+     */
+    Color* paletteGradient(EPalette palette);
+
+    /*!
+     * Marks the cached gradient of a palette as out of date.
+     *
+     * \param palette the palette whose colors changed.
+     */
+    void invalidateGradient(EPalette palette);
+
+    /*!
+     * Gives this instance its own copy of the custom colors if they are shared, so that
+     * they can be changed without changing the other instances.
+     */
+    void detachCustomColors();
+
+    /*!
+     * Stops using m_custom, and frees it if no other instance uses it.
+     */
+    void releaseCustomColors();
+
+    /*!
+     * Checks if the custom colors changed since the routines last saw them, which can
+     * happen through another instance that shares them, and sets them up again if so.
+     */
+    void checkCustomColors();
+
     /*!
      * Sets two colors alternating in patches the size of barSize.
      * and moves them up in index on each frame.
@@ -457,7 +858,7 @@ private:
      *        For example, if this is set to true and the last time a value was chosen it chose
      *        2, then the next value will be anything else in the range except 2.
      */
-    void chooseRandomFromArray(Color *array, uint8_t max_index, boolean canRepeat);
+    void chooseRandomFromArray(const Color *array, uint8_t max_index, boolean canRepeat);
 
     /*!
      * Uses memset to change every value in the r_buffer to r, the g_buffer to g, and the b_buffer
@@ -469,6 +870,93 @@ private:
      */
     void fillColorBuffers(uint8_t r, uint8_t g, uint8_t b);
 
+    /*!
+     * In the indexed buffer modes, makes the indices stand for the colors of the palette in
+     * m_palette. Called by the multi color routines that draw with drawPaletteColor.
+     */
+    void setupPaletteIndices();
+
+    /*!
+     * Draws a color from m_palette to the LED at index i.
+     *
+     * \param i the index of the LED, must be less than the number of LEDs.
+     * \param paletteIndex the index of the color in m_palette.
+     * \param divisor how much to dim the color by, between 1 and 16.
+     */
+    void drawPaletteColor(uint16_t i, uint8_t paletteIndex, uint8_t divisor = 1);
+
+    /*!
+     * Fills colors, which holds 10 colors, with the palette in m_palette rotated by
+     * step / blendSteps colors. Between whole colors, each entry is a blend of two
+     * neighbouring colors of the palette.
+     */
+    void rotatePalette(uint16_t step, uint8_t blendSteps, Color *colors);
+
+    /*!
+     * Called by routines that repeat every m_loop_index updates, on the update at
+     * m_temp_index. If the frame cache holds the frame, copies it to the buffers and leaves
+     * the loop values the way computing it would.
+     *
+     * \return true if the frame was copied from the cache.
+     */
+    bool readCachedFrame();
+
+    /*!
+     * Stores the frame that was just computed for the update at m_temp_index in the frame
+     * cache, if the cycle fits in it.
+     */
+    void writeCachedFrame();
+
+    /*!
+     * Drops the frames in the frame cache, called when the frames of the routine change.
+     */
+    void invalidateFrameCache();
+
+    /*!
+     * Number of bytes in m_index_buffer.
+     */
+    uint16_t indexBufferSize();
+
+    /*!
+     * Number of bytes in m_temp_buffer.
+     */
+    uint16_t tempBufferSize();
+
+    /*!
+     * Stores an index for the LED at index i in the indexed buffer modes. Palette indices are
+     * stored in the low 4 bits and the divisor minus one in the high 4 bits. Shades of
+     * m_index_colors[0] are stored as a value between 0 and 255. ePackedIndexedBuffer only
+     * keeps the palette index or the top 4 bits of the shade.
+     */
+    void writeIndex(uint16_t i, uint8_t index);
+
+    /*!
+     * Reads the index of the LED at index i, in the same format as writeIndex.
+     */
+    uint8_t readIndex(uint16_t i);
+
+    /*!
+     * Retrieve the index of the computed LED that the LED at index i shows, based on m_symmetry.
+     */
+    uint16_t segmentIndex(uint16_t i);
+
+    /*!
+     * Retrieve the color stored for the pixel at index i. The index must already have the
+     * symmetry applied, see segmentIndex.
+     */
+    Color storedColor(uint16_t i);
+
+    /*!
+     * Retrieve the color of the LED at a position in the pixels, in 16.16 fixed point,
+     * based on m_scaling.
+     */
+    Color scaledColor(uint32_t position);
+
+    /*!
+     * Blends two colors in 8 bit fixed point, by fraction / 256 of the way from one to the other.
+     */
+    Color blendColors(Color from, Color to, uint8_t fraction);
+
     /*!
      * Sets the size of bars in routines that use them. Bars are groups of LEDs that
      * all display the same color. The routines SingleWave, MultiBarsSolid, and
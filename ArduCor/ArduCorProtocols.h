@@ -14,7 +14,7 @@
  * between the two projects seem mixed up, check that the version of the Corluma App you are using
  * matches the version of the your ArduCor library.
  *
- * Protocol Version: 3.3
+ * Protocol Version: 3.5
  *
  */
 
@@ -249,5 +249,26 @@ enum EPacketHeader
    * <i>Sends back a packet that contains the size of the custom array and all of the colors in it. </i>
    */
   eCustomArrayUpdateRequest,
+  /*!
+   * <b>8</b><br>
+   * <i>Takes one parameter, the last state sequence number the client received. Sends back
+   * only the state update values that changed since that sequence number.</i>
+   */
+  eDeltaStateUpdateRequest,
+  /*!
+   * <b>9</b><br>
+   * <i>Takes the index of the first LED to change, then one to three runs of a count and a
+   * 0-255 representation of Red, Green, and Blue. Each run sets the next count LEDs to its
+   * color. Used by a host that renders the routines itself, the device stops running its own
+   * routine until it receives a mode change.</i>
+   */
+  eFrameUpdate,
+  /*!
+   * <b>10</b><br>
+   * <i>Takes one parameter, a 0-255 sequence number picked by the host. A packet that contains
+   * one is answered with an acknowledgement instead of an echo, which holds the sequence number
+   * and bit flags of the messages in the packet that were applied. Added in API level 3.5.</i>
+   */
+  eSequenceNumber,
   ePacketHeader_MAX //total number of Packet Headers
 };
@@ -7,209 +7,251 @@
  *            MIT License
  *            </a>
  *
- * These color palettes are stored in program memory and loaded into a buffer when accessed.
- * This makes the presets read-only, but in return, it allows them to take a much smaller hit
- * on SRAM usage.
+ * These color palettes are read-only. On AVR boards they are stored in program memory and
+ * loaded into a buffer when accessed, which allows them to take a much smaller hit on SRAM
+ * usage. On boards and computers with a single address space, such as the ESP32 and ARM
+ * boards, they are `constexpr` arrays that the routines read in place. Use presetSize() and
+ * presetColors() to read them, so that the routines work the same on both.
  *
  */
 
+#include "ArduCor.h"
+
+#if defined(__AVR__)
 #include <avr/pgmspace.h>
+#define PALETTE_STORAGE const PROGMEM
+#else
+#define PALETTE_STORAGE constexpr
+#endif
+
+// the number of colors in a palette array
+#define PALETTE_SIZE(colors) (sizeof(colors) / sizeof(ArduCor::Color))
 
 
 //==========
 // Water
 //==========
-const PROGMEM uint8_t waterColors[]        = { 0,   0,   255,
-                                               0,   25,  225,
-                                               0,   0,   127,
-                                               120, 120, 255,
-                                               0,   0,   255,
-                                               0,   25,  225,
-                                               0,   0,   127,
-                                               0,   127, 127,
-                                               120, 120, 255 };
+PALETTE_STORAGE ArduCor::Color waterColors[]        = { {0,   0,   255},
+                                                        {0,   25,  225},
+                                                        {0,   0,   127},
+                                                        {120, 120, 255},
+                                                        {0,   0,   255},
+                                                        {0,   25,  225},
+                                                        {0,   0,   127},
+                                                        {0,   127, 127},
+                                                        {120, 120, 255} };
 
 //==========
 // Frozen
 //==========
-const PROGMEM uint8_t frozenColors[]       = { 0,   127, 255,
-                                               169, 228, 247,
-                                               200, 0,   255,
-                                               200, 200, 200,
-                                               127, 127, 127,
-                                               127, 127, 255 };
+PALETTE_STORAGE ArduCor::Color frozenColors[]       = { {0,   127, 255},
+                                                        {169, 228, 247},
+                                                        {200, 0,   255},
+                                                        {200, 200, 200},
+                                                        {127, 127, 127},
+                                                        {127, 127, 255} };
 
 //==========
 // Snow
 //==========
-const PROGMEM uint8_t snowColors[]         = { 255, 255, 255,
-                                               127, 127, 127,
-                                               200, 200, 200,
-                                               0,   0,   255,
-                                               0,   255, 255,
-                                               0,   180, 180 };
+PALETTE_STORAGE ArduCor::Color snowColors[]         = { {255, 255, 255},
+                                                        {127, 127, 127},
+                                                        {200, 200, 200},
+                                                        {0,   0,   255},
+                                                        {0,   255, 255},
+                                                        {0,   180, 180} };
 
 //==========
 // Cool
 //==========
-const PROGMEM uint8_t coolColors[]         = { 0,   255, 0,
-                                               125, 0,   255,
-                                               0,   0,   255,
-                                               40,  127, 40,
-                                               60,  0,   160 };
+PALETTE_STORAGE ArduCor::Color coolColors[]         = { {0,   255, 0},
+                                                        {125, 0,   255},
+                                                        {0,   0,   255},
+                                                        {40,  127, 40},
+                                                        {60,  0,   160} };
 
 
 //==========
 // Warm
 //==========
-const PROGMEM uint8_t warmColors[]         = { 255, 255, 0,
-                                               255, 0,   0,
-                                               255, 45,  0,
-                                               255, 200, 0,
-                                               255, 127, 0 };
+PALETTE_STORAGE ArduCor::Color warmColors[]         = { {255, 255, 0},
+                                                        {255, 0,   0},
+                                                        {255, 45,  0},
+                                                        {255, 200, 0},
+                                                        {255, 127, 0} };
 
 //==========
 // Fire
 //==========
-const PROGMEM uint8_t fireColors[]         = { 255, 70,  0,
-                                               255, 20,  0,
-                                               255, 80,  0,
-                                               255, 5,   0,
-                                               64,  6,   0,
-                                               127, 127, 0,
-                                               255, 60,  0,
-                                               255, 45,  0,
-                                               127, 127, 0 };
+PALETTE_STORAGE ArduCor::Color fireColors[]         = { {255, 70,  0},
+                                                        {255, 20,  0},
+                                                        {255, 80,  0},
+                                                        {255, 5,   0},
+                                                        {64,  6,   0},
+                                                        {127, 127, 0},
+                                                        {255, 60,  0},
+                                                        {255, 45,  0},
+                                                        {127, 127, 0} };
 
 //==========
 // Evil
 //==========
-const PROGMEM uint8_t evilColors[]         = { 255, 0,   0,
-                                               200, 0,   0,
-                                               127, 0,   0,
-                                               20,  0,   0,
-                                               20,  0,   0,
-                                               30,  0,   40,
-                                               10,  0,   0,
-                                               80,  0,   0 };
+PALETTE_STORAGE ArduCor::Color evilColors[]         = { {255, 0,   0},
+                                                        {200, 0,   0},
+                                                        {127, 0,   0},
+                                                        {20,  0,   0},
+                                                        {20,  0,   0},
+                                                        {30,  0,   40},
+                                                        {10,  0,   0} };
 
 //==========
 // Corrosive
 //==========
-const PROGMEM uint8_t corrosiveColors[]    = { 0,   255, 0,
-                                               0,   200, 0,
-                                               60,  180, 60,
-                                               127, 135, 127,
-                                               10,  255, 10 };
+PALETTE_STORAGE ArduCor::Color corrosiveColors[]    = { {0,   255, 0},
+                                                        {0,   200, 0},
+                                                        {60,  180, 60},
+                                                        {127, 135, 127},
+                                                        {10,  255, 10} };
 
 
 //==========
 // Poison
 //==========
-const PROGMEM uint8_t poisonColors[]       = { 80,  0,   180,
-                                               120, 0,   255,
-                                               10,  0,   20,
-                                               25,  0,   25,
-                                               60,  40,  60,
-                                               120, 0,   255,
-                                               80,  0,   180 };
+PALETTE_STORAGE ArduCor::Color poisonColors[]       = { {80,  0,   180},
+                                                        {120, 0,   255},
+                                                        {10,  0,   20},
+                                                        {25,  0,   25},
+                                                        {60,  40,  60},
+                                                        {120, 0,   255},
+                                                        {80,  0,   180} };
 
 //==========
 // Rose
 //==========
-const PROGMEM uint8_t roseColors[]         = { 216, 30,  100,
-                                               156, 62,  72,
-                                               255, 245, 251,
-                                               127, 127, 127,
-                                               194, 30,  86,
-                                               194, 30,  30 };
+PALETTE_STORAGE ArduCor::Color roseColors[]         = { {216, 30,  100},
+                                                        {156, 62,  72},
+                                                        {255, 245, 251},
+                                                        {127, 127, 127},
+                                                        {194, 30,  86},
+                                                        {194, 30,  30} };
 
 //==========
 // Pink Green
 //==========
-const PROGMEM uint8_t pinkGreenColors[]    = { 255, 20,  147,
-                                               0,   255, 0,
-                                               0,   200, 0,
-                                               255, 105, 180 };
+PALETTE_STORAGE ArduCor::Color pinkGreenColors[]    = { {255, 20,  147},
+                                                        {0,   255, 0},
+                                                        {0,   200, 0},
+                                                        {255, 105, 180} };
 
 //==========
 // Red White Blue
 //==========
-const PROGMEM uint8_t redWhiteBlueColors[] = { 255, 255, 255,
-                                               255, 0,   0,
-                                               0,   0,   255,
-                                               255, 255, 255 };
+PALETTE_STORAGE ArduCor::Color redWhiteBlueColors[] = { {255, 255, 255},
+                                                        {255, 0,   0},
+                                                        {0,   0,   255},
+                                                        {255, 255, 255} };
 
 
 //==========
 // RGB
 //==========
-const PROGMEM uint8_t RGBColors[]          = { 255, 0,   0,
-                                               0,   255, 0,
-                                               0,   0,   255 };
+PALETTE_STORAGE ArduCor::Color RGBColors[]          = { {255, 0,   0},
+                                                        {0,   255, 0},
+                                                        {0,   0,   255} };
 
 
 //==========
 // CMY
 //==========
-const PROGMEM uint8_t CMYColors[]          = { 255, 255, 0,
-                                               0,   255, 255,
-                                               255, 0,   255 };
+PALETTE_STORAGE ArduCor::Color CMYColors[]          = { {255, 255, 0},
+                                                        {0,   255, 255},
+                                                        {255, 0,   255} };
 
 //==========
 // Six Colors
 //==========
-const PROGMEM uint8_t sixColors[]          = { 255, 0,   0,
-                                               255, 255, 0,
-                                               0,   255, 0,
-                                               0,   255, 255,
-                                               0,   0,   255,
-                                               255, 0,   255 };
+PALETTE_STORAGE ArduCor::Color sixColors[]          = { {255, 0,   0},
+                                                        {255, 255, 0},
+                                                        {0,   255, 0},
+                                                        {0,   255, 255},
+                                                        {0,   0,   255},
+                                                        {255, 0,   255} };
 
 
 //==========
 // Seven Colors
 //==========
-const PROGMEM uint8_t sevenColors[]        = { 255, 0,   0,
-                                               255, 255, 0,
-                                               0,   255, 0,
-                                               0,   255, 255,
-                                               0,    0,   255,
-                                               255,  0,   255,
-                                               255, 255, 255 };
-
-
-const uint8_t* const colorPresets[] PROGMEM = { waterColors,
-                                                frozenColors,
-                                                snowColors,
-                                                coolColors,
-                                                warmColors,
-                                                fireColors,
-                                                evilColors,
-                                                corrosiveColors,
-                                                poisonColors,
-                                                roseColors,
-                                                pinkGreenColors,
-                                                redWhiteBlueColors,
-                                                RGBColors,
-                                                CMYColors,
-                                                sixColors,
-                                                sevenColors };
-
-
-const PROGMEM uint8_t presetSizes []        = { 9,
-                                                6,
-                                                6,
-                                                5,
-                                                5,
-                                                9,
-                                                7,
-                                                5,
-                                                7,
-                                                6,
-                                                4,
-                                                4,
-                                                3,
-                                                3,
-                                                6,
-                                                7 };
+PALETTE_STORAGE ArduCor::Color sevenColors[]        = { {255, 0,   0},
+                                                        {255, 255, 0},
+                                                        {0,   255, 0},
+                                                        {0,   255, 255},
+                                                        {0,   0,   255},
+                                                        {255, 0,   255},
+                                                        {255, 255, 255} };
+
+
+//==========
+// Presets
+//==========
+/*!
+ * A preset palette and the number of colors in it.
+ */
+struct PalettePreset
+{
+    const ArduCor::Color *colors;
+    uint8_t size;
+};
+
+// the presets in the order of EPalette, starting at eWater
+PALETTE_STORAGE PalettePreset palettePresets[] = { {waterColors, PALETTE_SIZE(waterColors)},
+                                                   {frozenColors, PALETTE_SIZE(frozenColors)},
+                                                   {snowColors, PALETTE_SIZE(snowColors)},
+                                                   {coolColors, PALETTE_SIZE(coolColors)},
+                                                   {warmColors, PALETTE_SIZE(warmColors)},
+                                                   {fireColors, PALETTE_SIZE(fireColors)},
+                                                   {evilColors, PALETTE_SIZE(evilColors)},
+                                                   {corrosiveColors, PALETTE_SIZE(corrosiveColors)},
+                                                   {poisonColors, PALETTE_SIZE(poisonColors)},
+                                                   {roseColors, PALETTE_SIZE(roseColors)},
+                                                   {pinkGreenColors, PALETTE_SIZE(pinkGreenColors)},
+                                                   {redWhiteBlueColors, PALETTE_SIZE(redWhiteBlueColors)},
+                                                   {RGBColors, PALETTE_SIZE(RGBColors)},
+                                                   {CMYColors, PALETTE_SIZE(CMYColors)},
+                                                   {sixColors, PALETTE_SIZE(sixColors)},
+                                                   {sevenColors, PALETTE_SIZE(sevenColors)} };
+
+
+/*!
+ * Retrieve the number of colors in a preset palette.
+ *
+ * \param palette a preset palette, must not be eCustom.
+ */
+inline uint8_t presetSize(EPalette palette)
+{
+#if defined(__AVR__)
+    return pgm_read_byte_near(&palettePresets[palette - 1].size);
+#else
+    return palettePresets[palette - 1].size;
+#endif
+}
+
+/*!
+ * Retrieve the colors of a preset palette. On AVR boards, the colors are copied out of program
+ * memory into the buffer. Everywhere else, the preset itself is returned and the buffer is unused.
+ *
+ * \param palette a preset palette, must not be eCustom.
+ * \param buffer a buffer that can hold the colors of any preset palette.
+ * \return the colors of the palette.
+ */
+inline const ArduCor::Color* presetColors(EPalette palette, ArduCor::Color *buffer)
+{
+#if defined(__AVR__)
+    memcpy_P(buffer,
+             (const void*)pgm_read_word_near(&palettePresets[palette - 1].colors),
+             presetSize(palette) * sizeof(ArduCor::Color));
+    return buffer;
+#else
+    (void)buffer;
+    return palettePresets[palette - 1].colors;
+#endif
+}
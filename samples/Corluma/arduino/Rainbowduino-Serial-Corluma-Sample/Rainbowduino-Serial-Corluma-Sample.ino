@@ -24,6 +24,17 @@ const int  LED_COUNT         = 64;
 const byte BAR_SIZE          = 4;      // default length of a bar for bar routines
 const byte GLIMMER_PERCENT   = 10;     // percent of "glimmering" LEDs in glimmer routines: range: 0 - 100
 
+// computes the routines for part of each device's LEDs and copies it to the rest. eMirror mirrors
+// the routines around the center of the LEDs, eRepeat repeats them SYMMETRY_REPEATS times, such
+// as around a ring. Frames from a server set every LED on its own, without the symmetry.
+const ArduCor::ESymmetry SYMMETRY = ArduCor::eNoSymmetry;
+const byte SYMMETRY_REPEATS  = 2;      // number of copies of the LEDs with eRepeat
+
+// shows each update of the routines over this many frames, blending from one update to the next,
+// so that the LEDs refresh more often and move more smoothly for the same work. Takes 6 bytes of
+// memory for each LED when it is more than 1.
+const byte FRAME_INTERPOLATION = 1;
+
 const byte DELAY_VALUE       = 10;      // amount of sleep time between loops
 
 const int  DEFAULT_SPEED     = 100;    // default delay for LEDs update, suggested range: 0 (paused) - 200 (fast).
@@ -34,14 +45,33 @@ const int  DEFAULT_TIMEOUT   = 120;    // number of minutes without packets unti
 const int  DEFAULT_HW_INDEX  = 1;      // index for this particular microcontroller
 const int  DEVICE_COUNT      = 1;      // number of LED devices connected, 1 for every sample except the multi sample
 
+//=======================
+// Checksum Types
+//=======================
+
+// enum for the types of checksums that can be appended to packets. The values
+// are bit flags so that a discovery packet can advertise every type that a sample
+// supports in a single value. CRC-32 uses the value 1 so that samples that only
+// support CRC-32 still send the same discovery packet as older samples.
+enum EChecksumType {
+  eNoChecksum = 0,
+  eCRC32      = 1,
+  eCRC16      = 2,
+  eFletcher16 = 4
+};
+
 const bool USE_CRC           = true;   // true uses CRC, false ignores it.
 const bool USE_NEWLINE       = false;  // true adds newline to serial packets, false skips it.
+// checksum types a client can choose from when USE_CRC is true. CRC-32 is always used until a
+// client selects a different type. Remove types to save PROGMEM on smaller arduinos.
+const uint8_t CHECKSUM_TYPES = eCRC32 | eCRC16 | eFletcher16;
 
 //=======================
 // Hardware Name
 //=======================
 
-// rename this whatever you want, but keep it under 16 characters
+// rename this whatever you want, but keep it under 13 characters. When more than one
+// device is connected, each device after the first adds its hardware index to the name.
 char name_buffer[] = "MyLights";
 
 //=======================
@@ -88,32 +118,77 @@ EProductType product_type = eRainbowduino;
 // new functions added that do not significantly break the existing
 // messaging protocol.
 const uint8_t API_LEVEL_MAJOR = 3;
-const uint8_t API_LEVEL_MINOR = 3;
+const uint8_t API_LEVEL_MINOR = 5;
 
 
 //=======================
 // Stored Values and States
 //=======================
 
-ERoutine current_routine = eSingleGlimmer;
-EPalette current_palette = eCustom;
+// number of values after the hardware index in a state update message. The values before
+// the idle timeout, up to the speed, fit in a byte.
+const uint8_t STATE_FIELD_COUNT = 11;
+const uint8_t STATE_BYTE_FIELD_COUNT = 9;
+
+/*!
+ * The state of a single LED device. Every sample keeps a table of DEVICE_COUNT devices, 
+ * and messages are applied by looping over the table, so the same code handles one device
+ * or many.
+ */
+struct DeviceState
+{
+  // Library used to generate the RGB LED routines.
+  ArduCor*      routines;
+  uint8_t       hardware_index;
+
+  ERoutine      current_routine;
+  EPalette      current_palette;
+  // value determines how quickly the LEDs udpate. Lower values lead to faster updates
+  int           update_speed;
+  bool          should_update_no_speed;
+  // true while a host renders the routines and sends frames, the device's own routine
+  // is paused until a mode change is received.
+  bool          is_streaming;
+  unsigned long idle_timeout;
+
+  int           single_glimmer_param;
+  int           multi_glimmer_param;
+  bool          sawtooth_param;
+  bool          fade_param;
+  int           multi_bars_param;
+
+  // sequence number of the last delta state update sent. It starts at 1 and skips 0
+  // when it wraps, so that a client can always send 0 to request every field.
+  uint8_t       state_sequence;
+  // state fields as of the last delta state update sent, the two idle timeout fields
+  // are kept apart since they don't fit in a byte.
+  uint8_t       state_snapshot[STATE_BYTE_FIELD_COUNT];
+  uint16_t      timeout_snapshot[STATE_FIELD_COUNT - STATE_BYTE_FIELD_COUNT];
+};
+
+DeviceState devices[DEVICE_COUNT];
+
+// checksum currently appended to and expected on packets. Clients can change this by sending
+// a DISCOVERY_PACKET followed by the EChecksumType they want to use.
+uint8_t checksum_type = USE_CRC ? eCRC32 : eNoChecksum;
 
 // set this to turn off echoing all together
 bool skip_echo = false;
 // the sample sets this when it receives a valid packet
 bool should_echo = false;
+// set when a packet contains a sequence number. The packet is answered with an
+// acknowledgement of the messages that were applied instead of an echo.
+bool has_sequence = false;
+uint8_t sequence_number = 0;
+// bit n is set if the nth message of the current packet was applied. Only the first 32
+// messages have a bit, so the server sample puts at most 32 messages, including the
+// sequence number, in a packet with a sequence number.
+unsigned long applied_messages = 0;
 
 // used in sketches with multiple hardware connected to one arduino.
 uint8_t received_hardware_index;
-uint8_t hardware_index = DEFAULT_HW_INDEX;
-
-// value determines how quickly the LEDs udpate. Lower values lead to faster updates
-int update_speed = DEFAULT_SPEED;
-bool should_update_no_speed = false;
-
 
 // timeout variables
-unsigned long idle_timeout = (unsigned long)DEFAULT_TIMEOUT * 60 * 1000; // convert to milliseconds
 unsigned long last_message_time = 0;
 
 // counts each loop and uses it to determine
@@ -146,35 +221,19 @@ int multi_packet_size = 0;
 int current_multi_packet = 0;
 int int_array_size = 0;
 
-// buffers for char arrays
-char state_update_packet[110];
+// buffers for char arrays. A state update uses up to 54 characters per device, plus 15 for
+// the checksum and delimiters, and a single device keeps the 110 characters it always had.
+// Anything written past the end is dropped.
+char state_update_packet[((DEVICE_COUNT * 54) + 15) > 110 ? ((DEVICE_COUNT * 54) + 15) : 110];
 
-char discovery_packet[54];
+// the discovery packet uses up to 35 characters plus 22 characters for each device.
+char discovery_packet[35 + DEVICE_COUNT * 22];
 
 // used for string manipulations
 char num_buf[16];
-const char value_delimiter[] = ",";
-const char message_delimiter[] = "&";
-const char crc_delimiter[] = "#";
-const char packet_delimiter[] = ";";
-const char names_delimiter[] = "@";
 const char new_line[] = "\n";
 
-int  single_glimmer_param = GLIMMER_PERCENT;
-int  multi_glimmer_param  = GLIMMER_PERCENT;
-bool sawtooth_param       = false;
-bool fade_param           = false;
-int  multi_bars_param     = BAR_SIZE;
-
 
-bool reset_counter = false;
-
-
-//=======================
-// ArduCor Setup
-//=======================
-// Library used to generate the RGB LED routines.
-ArduCor routines = ArduCor(LED_COUNT);
 
 
 //=======================
@@ -214,24 +273,283 @@ unsigned long crcCalculator(const char* packet)
   return crc;
 }
 
+//=======================
+// CRC-16/CCITT
+//=======================
+// Uses the same nibble-at-a-time approach as the CRC-32 with the CCITT polynomial (0x1021),
+// an initial value of 0xFFFF and no reflection. Half the digits of a CRC-32 for
+// roughly half the work on an 8-bit microcontroller.
+
+const PROGMEM uint16_t crc16Table[16] =
+{
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+  0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+};
+
+uint16_t crc16Update(uint16_t crc, byte data)
+{
+  crc = pgm_read_word_near(crc16Table + ((crc >> 12) ^ (data >> 4))) ^ (crc << 4);
+  crc = pgm_read_word_near(crc16Table + ((crc >> 12) ^ (data & 0x0f))) ^ (crc << 4);
+  return crc;
+}
+
+//=======================
+// Fletcher-16
+//=======================
+// The cheapest of the checksums, it only needs two additions per byte. The modulo is 
+// replaced by a subtraction since each sum is always less than 2 * 255 before it is reduced.
+
+uint16_t fletcher16Update(uint16_t sums, byte data)
+{
+  uint16_t sum1 = (sums & 0xff) + data;
+  if (sum1 >= 255) sum1 -= 255;
+  uint16_t sum2 = (sums >> 8) + sum1;
+  if (sum2 >= 255) sum2 -= 255;
+  return (sum2 << 8) | sum1;
+}
+
+/*!
+ * @brief checksumBegin returns the starting value of a checksum using the checksum_type currently
+ *        chosen by the client.
+ */
+unsigned long checksumBegin()
+{
+  switch (checksum_type)
+  {
+    case eCRC32:
+      return ~0L;
+    case eCRC16:
+      return 0xFFFF;
+    default:
+      return 0;
+  }
+}
+
+/*!
+ * @brief checksumUpdate adds a single character to a checksum started by checksumBegin.
+ */
+unsigned long checksumUpdate(unsigned long checksum, byte data)
+{
+  switch (checksum_type)
+  {
+    case eCRC32:
+      return crcUpdate(checksum, data);
+    case eCRC16:
+      return crc16Update(checksum, data);
+    case eFletcher16:
+      return fletcher16Update(checksum, data);
+    default:
+      return 0;
+  }
+}
+
+/*!
+ * @brief checksumEnd returns the final value of a checksum after all characters have been added.
+ */
+unsigned long checksumEnd(unsigned long checksum)
+{
+  if (checksum_type == eCRC32) {
+    return ~checksum;
+  }
+  return checksum;
+}
+
+/*!
+ * @brief checksumCalculator computes the checksum of a null terminated packet using
+ *        the checksum_type currently chosen by the client.
+ *
+ * @param packet the packet that needs a checksum
+ *
+ * @return the checksum, or 0 if no checksum is used.
+ */
+unsigned long checksumCalculator(const char* packet)
+{
+  unsigned long checksum = checksumBegin();
+  uint16_t i = 0;
+  while (packet[i] != 0) {
+    checksum = checksumUpdate(checksum, packet[i]);
+    ++i;
+  }
+  return checksumEnd(checksum);
+}
+
+/*!
+ * @brief parseChecksumSelection handles the message a client sends to choose a checksum type,
+ *        which is a discovery packet with the requested EChecksumType appended, such as
+ *        `DISCOVERY_PACKET,4`. 
+ *
+ * @param message the discovery message, without its packet delimiter.
+ *
+ * @return true if the checksum type is supported and is now in use, false otherwise.
+ */
+bool parseChecksumSelection(const char* message)
+{
+  if (!USE_CRC || message[16] != ',') {
+    return false;
+  }
+  int requested = atoi(message + 17);
+  // only accept a single supported type, never a combination of types.
+  if ((requested == eCRC32 || requested == eCRC16 || requested == eFletcher16)
+      && (requested & CHECKSUM_TYPES)) {
+    checksum_type = requested;
+    return true;
+  }
+  return false;
+}
+
+//=======================
+// Packet Writer
+//=======================
+
+/*!
+ * Builds a packet in a char buffer by writing each value at a cursor. Unlike strcat, it 
+ * never rescans the buffer to find its end, and the checksum is updated as each character
+ * is written so the packet doesn't need a second pass before its checksum is appended.
+ * Writes that don't fit in the buffer are dropped, and the buffer is always null terminated.
+ */
+struct PacketWriter
+{
+  char*         buffer;
+  uint16_t      size;
+  uint16_t      length;
+  unsigned long checksum;
+
+  void begin(char* packetBuffer, uint16_t bufferSize)
+  {
+    buffer = packetBuffer;
+    size = bufferSize;
+    length = 0;
+    buffer[0] = 0;
+    checksum = checksumBegin();
+  }
+
+  void write(char c)
+  {
+    if (length < size - 1) {
+      buffer[length++] = c;
+      buffer[length] = 0;
+      checksum = checksumUpdate(checksum, c);
+    }
+  }
+
+  void write(const char* text)
+  {
+    while (*text != 0) {
+      write(*text++);
+    }
+  }
+
+  void writeNumber(unsigned long value)
+  {
+    // digits are generated lowest first, so store them and write them in reverse.
+    char digits[10];
+    uint8_t count = 0;
+    do {
+      digits[count++] = '0' + (value % 10);
+      value /= 10;
+    } while (value != 0);
+    while (count > 0) {
+      write(digits[--count]);
+    }
+  }
+
+  // writes a value followed by a value delimiter
+  void writeValue(unsigned long value)
+  {
+    writeNumber(value);
+    write(',');
+  }
+
+  // writes a value that ends a message, followed by a message delimiter
+  void writeLastValue(unsigned long value)
+  {
+    writeNumber(value);
+    write('&');
+  }
+
+  // appends the checksum of everything written so far, if a checksum is used,
+  // and then the delimiters that end a packet.
+  void end(bool useChecksum)
+  {
+    if (useChecksum && (checksum_type != eNoChecksum)) {
+      unsigned long finalChecksum = checksumEnd(checksum);
+      write('#');
+      writeNumber(finalChecksum);
+      write('&');
+    }
+    write(';');
+    // add the newline
+    if (USE_NEWLINE) {
+      write(new_line);
+    }
+  }
+};
+
+// builds state update and discovery packets
+PacketWriter packet_writer;
+// builds the echo_message while a packet is parsed
+PacketWriter echo_writer;
+
 //================================================================================
 // Setup and Loop
 //================================================================================
 
 void setup()
 {
+  setupDevices();
   Rb.init();
 
-  // choose the default color for the single
-  // color routines. This can be changed at any time.
-  // and its set it to green in sample routines.
-  // If its not set, it defaults to a faint orange.
-  routines.setMainColor(0, 127, 0);
   // put your setup code here, to run once:
   Serial.begin(9600);
   buildDiscoveryPacket();
 }
 
+/*!
+ * @brief setupDevices fills the device table with the default state of each device and
+ *        splits the LEDs evenly between the devices.
+ */
+void setupDevices()
+{
+  for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+    DeviceState& device = devices[i];
+    device.routines = new ArduCor(LED_COUNT / DEVICE_COUNT);
+    device.routines->symmetry(SYMMETRY, SYMMETRY_REPEATS);
+    device.routines->frameInterpolation(FRAME_INTERPOLATION);
+    if (i > 0) {
+      // the devices start with the same custom colors, so they only need to be stored once
+      device.routines->shareCustomColors(*devices[0].routines);
+    }
+    device.hardware_index = DEFAULT_HW_INDEX + i;
+    device.current_routine = eSingleGlimmer;
+    device.current_palette = eCustom;
+    device.update_speed = DEFAULT_SPEED;
+    device.should_update_no_speed = false;
+    device.is_streaming = false;
+    device.idle_timeout = (unsigned long)DEFAULT_TIMEOUT * 60 * 1000; // convert to milliseconds
+    device.single_glimmer_param = GLIMMER_PERCENT;
+    device.multi_glimmer_param = GLIMMER_PERCENT;
+    device.sawtooth_param = false;
+    device.fade_param = false;
+    device.multi_bars_param = BAR_SIZE;
+    device.state_sequence = 1;
+    // choose the default color for the single
+    // color routines. This can be changed at any time.
+    // and its set it to green in sample routines.
+    // If its not set, it defaults to a faint orange.
+    device.routines->setMainColor(0, 127, 0);
+  }
+}
+
+/*!
+ * @brief isReceivingDevice checks if the message in packet_int_array is meant for a device.
+ *
+ * @return true if the received hardware index is the device's index or 0.
+ */
+bool isReceivingDevice(const DeviceState& device)
+{
+  return (received_hardware_index == device.hardware_index) || (received_hardware_index == 0);
+}
+
 void loop()
 {
   packetReceived = false;
@@ -241,7 +559,8 @@ void loop()
  }
  if (current_packet[0] == 'D') {
     char* pch = strstr (current_packet,"DISCOVERY_PACKET");
-    if (strcmp(pch, "DISCOVERY_PACKET") == 0) {
+    if ((pch != 0)
+        && ((strcmp(pch, "DISCOVERY_PACKET") == 0) || parseChecksumSelection(pch))) {
       Serial.write(discovery_packet);
     }
   } else if (current_packet[0] != 0) {
@@ -253,17 +572,32 @@ void loop()
     bool messageIsValid = checkIfPacketIsValid(current_packet);
     skip_echo = false;
     should_echo = false;
-    should_update_no_speed = false; 
+    has_sequence = false;
+    applied_messages = 0;
+    uint8_t message_index = 0;
+    for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+      devices[i].should_update_no_speed = false;
+    }
     if (messageIsValid) { 
+      // split the packet into messages up front, so that each message
+      // can check if a later message in the packet overwrites it.
+      char* packetEnd = splitMessages(current_packet);
+      char* messagePtr = current_packet;
       // go through each message packet
-      char* messagePtr = strtok(current_packet, "&");
-      while (messagePtr != 0) {
+      while (messagePtr < packetEnd) {
+        if (*messagePtr == 0) {
+          // skip empty messages
+          ++messagePtr;
+          continue;
+        }
+        const char* message = messagePtr;
+        strcpy(temp_packet, message); // Copy for parsing a destructive way
         if (!skip_echo) {
-          strcpy(temp_packet, messagePtr); // Copy for parsing a destructive way
-          strcpy(echo_message, messagePtr); // save for echoing 
+          echo_writer.begin(echo_message, sizeof(echo_message));
+          echo_writer.write(message); // save for echoing 
         }
-        // Find the next substring delimited by a "&"
-        messagePtr = strtok(0, "&");
+        // Find the next message
+        messagePtr += strlen(messagePtr) + 1;
         
         // convert from a array of chars into an int array
         delimitedStringToIntArray(temp_packet);
@@ -271,39 +605,72 @@ void loop()
         if ((int_array_size > 0)
             && (packet_int_array[0] < ePacketHeader_MAX)) {
           // message is valid and the first int can be interpeted as a header
-          //  attempt to parse the whole packet
-          if (parsePacket(packet_int_array[0])) {
+          //  attempt to parse the whole packet. If a later valid message in the packet 
+          //  overwrites everything this message changes, skip to the later message
+          //  so that only the final state is applied.
+          if (isMessageOverwritten(message, messagePtr, packetEnd)
+              || parsePacket(packet_int_array[0])) {
             // if packet parsing is sucessful, echo the packet
             last_message_time = millis();
+            // messages past the 32nd can't be acknowledged
+            if (message_index < 32) {
+              applied_messages |= 1UL << message_index;
+            }
             if (!skip_echo) {
-              strcat(echo_message, message_delimiter);
+              echo_writer.write('&');
               should_echo = true;
             }
           }
         }
+        ++message_index;
       }
-      if (!skip_echo && should_echo) {
+      if (has_sequence) {
+        // the acknowledgement replaces the echo and is sent even if the packet held
+        // requests, so the host knows which of its messages were applied.
+        echo_writer.begin(echo_message, sizeof(echo_message));
+        echo_writer.writeValue((uint8_t)eSequenceNumber);
+        echo_writer.writeValue(sequence_number);
+        echo_writer.writeLastValue(applied_messages);
+        echoPacket();
+      } else if (!skip_echo && should_echo) {
         echoPacket();
       }
     }
   }
 
-  if (update_speed == 0) { 
-    if (should_update_no_speed) { 
-      changeRoutine(current_routine); 
-      routines.applyBrightness();  
-      updateLEDs();
-    } 
-  } else if (!(loop_counter % ((MAX_SPEED_VALUE + 5) - update_speed))) { 
-    changeRoutine(current_routine);
-    routines.applyBrightness();
-    updateLEDs();
-  }
+  bool should_update_leds = false;
+  for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+    DeviceState& device = devices[i];
+    if (device.is_streaming) {
+      // frames are drawn as they are received, so only show them once.
+      should_update_leds |= device.should_update_no_speed;
+      device.should_update_no_speed = false;
+    } else if (device.update_speed == 0) { 
+      if (device.should_update_no_speed) { 
+        // a paused routine is shown right away
+        device.routines->nextFrame(true);
+        changeRoutine(device); 
+        device.routines->applyBrightness();  
+        should_update_leds = true;
+      } 
+    } else if (!(loop_counter % max(((MAX_SPEED_VALUE + 5) - device.update_speed)
+                                    / device.routines->frameInterpolation(), 1))) { 
+      // with frame interpolation, only some frames update the routine
+      if (device.routines->nextFrame()) {
+        changeRoutine(device);
+      }
+      device.routines->applyBrightness();
+      should_update_leds = true;
+    }
 
-  // Timeout the LEDs.
-  if ((idle_timeout != 0)
-      && (last_message_time + idle_timeout < millis())) {
-    routines.turnOff();
+    // Timeout the LEDs.
+    if ((device.idle_timeout != 0)
+        && (last_message_time + device.idle_timeout < millis())) {
+      device.routines->turnOff();
+    }
+  }
+  if (should_update_leds) {
+    updateLEDs();
   }
 
   loop_counter++;
@@ -313,13 +680,14 @@ void loop()
 
 void updateLEDs()
 {
+  ArduCor* routines = devices[0].routines;
   int index = 0;
   for (int x = 0; x < 8; x++) {
     for (int y = 0; y < 8; y++)  {
       Rb.setPixelXY(x, y,
-                    routines.red(index),
-                    routines.green(index),
-                    routines.blue(index));
+                    routines->red(index),
+                    routines->green(index),
+                    routines->blue(index));
       index++;
     }
   }
@@ -334,54 +702,56 @@ void updateLEDs()
  * @brief changeRoutine Function that runs every loop iteration
  *        and determines how to light up the LEDs.
  *
- * @param currentMode the current mode of the program
+ * @param device the device to update, using its current routine.
  */
-void changeRoutine(ERoutine currentMode)
+void changeRoutine(DeviceState& device)
 {
-  switch (currentMode)
+  ArduCor* routines = device.routines;
+  ArduCor::Color color = routines->mainColor();
+  switch (device.current_routine)
   {
     case eSingleSolid:
-      routines.singleSolid(routines.mainColor().red, routines.mainColor().green, routines.mainColor().blue);
+      routines->singleSolid(color.red, color.green, color.blue);
       break;
 
     case eSingleBlink:
-      routines.singleBlink(routines.mainColor().red, routines.mainColor().green, routines.mainColor().blue);
+      routines->singleBlink(color.red, color.green, color.blue);
       break;
 
     case eSingleWave:
-      routines.singleWave(routines.mainColor().red, routines.mainColor().green, routines.mainColor().blue);
+      routines->singleWave(color.red, color.green, color.blue);
       break;
 
     case eSingleGlimmer:
-      routines.singleGlimmer(routines.mainColor().red, routines.mainColor().green, routines.mainColor().blue, single_glimmer_param);
+      routines->singleGlimmer(color.red, color.green, color.blue, device.single_glimmer_param);
       break;
 
     case eSingleFade:
-      routines.singleFade(routines.mainColor().red, routines.mainColor().green, routines.mainColor().blue, fade_param);
+      routines->singleFade(color.red, color.green, color.blue, device.fade_param);
       break;
 
     case eSingleSawtoothFade:
-      routines.singleSawtoothFade(routines.mainColor().red, routines.mainColor().green, routines.mainColor().blue, sawtooth_param);
+      routines->singleSawtoothFade(color.red, color.green, color.blue, device.sawtooth_param);
       break;
 
     case eMultiGlimmer:
-      routines.multiGlimmer(current_palette, multi_glimmer_param);
+      routines->multiGlimmer(device.current_palette, device.multi_glimmer_param);
       break;
 
     case eMultiFade:
-      routines.multiFade(current_palette);
+      routines->multiFade(device.current_palette);
       break;
 
     case eMultiRandomSolid:
-      routines.multiRandomSolid(current_palette);
+      routines->multiRandomSolid(device.current_palette);
       break;
 
     case eMultiRandomIndividual:
-      routines.multiRandomIndividual(current_palette);
+      routines->multiRandomIndividual(device.current_palette);
       break;
 
     case eMultiBars:
-      routines.multiBars(current_palette, multi_bars_param);
+      routines->multiBars(device.current_palette, device.multi_bars_param);
       break;
 
     default:
@@ -403,85 +773,123 @@ bool parsePacket(int header)
 {
   // In each case, theres a final check that the packet was properly
   // formatted by making sure its getting the right number of values.
+  // Valid messages are then applied to each device they are meant for.
   boolean success = false;
+  if (int_array_size > 1) {
+    received_hardware_index = packet_int_array[1];
+  }
   switch (header)
   {
     case eOnOffChange:
-      if (int_array_size == 3) {
+      if (isStateChangeValid(header)) {
         success = true;
-        received_hardware_index = packet_int_array[1];
-        if ((received_hardware_index == hardware_index) || (received_hardware_index == 0)) {
-          if (packet_int_array[2] == 0) {
-            routines.turnOff();
-          } else if (packet_int_array[2] == 1) {
-            loop_counter = 0;
-            routines.turnOn();
+        for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+          DeviceState& device = devices[i];
+          if (isReceivingDevice(device)) {
+            if (packet_int_array[2] == 0) {
+              device.routines->turnOff();
+            } else if (packet_int_array[2] == 1) {
+              loop_counter = 0;
+              device.routines->turnOn();
+            }
           }
         }
       }
       break;
     case eModeChange:
-      success = routineParser(success);
+      success = routineParser(true);
       break;
     case eCustomArrayColorChange:
-      if (int_array_size == 6) {
+      if (isStateChangeValid(header)) {
         int color_index = packet_int_array[2];
-        if (color_index >= 0 && color_index < eRoutine_MAX) {
-          success = true;
-
-          // only tell the routines to reset themselves if a custom routine is used.
-          if ((current_routine > eSingleSawtoothFade)
-              && (current_palette == eCustom)) {
-            // Reset LEDS
-            loop_counter = 0;
-          }
-          received_hardware_index = packet_int_array[1];
-          if ((received_hardware_index == hardware_index) || (received_hardware_index == 0)) {
-            routines.setColor(color_index,
-                              packet_int_array[3],
-                              packet_int_array[4],
-                              packet_int_array[5]);
+        success = true;
+        // the first device that got the change, when it went to every device
+        ArduCor* shared_routines = NULL;
+        for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+          DeviceState& device = devices[i];
+          if (isReceivingDevice(device)) {
+            // only tell the routines to reset themselves if a custom routine is used.
+            if ((device.current_routine > eSingleSawtoothFade)
+                && (device.current_palette == eCustom)) {
+              // Reset LEDS
+              loop_counter = 0;
+            }
+            if (received_hardware_index != 0) {
+              device.routines->setColor(color_index,
+                                        packet_int_array[3],
+                                        packet_int_array[4],
+                                        packet_int_array[5]);
+            } else if ((shared_routines == NULL)
+                       || !device.routines->sharesCustomColors(*shared_routines)) {
+              // every device that shares these custom colors gets the change at once
+              device.routines->setSharedColor(color_index,
+                                              packet_int_array[3],
+                                              packet_int_array[4],
+                                              packet_int_array[5]);
+              if (shared_routines == NULL) {
+                shared_routines = device.routines;
+              }
+            }
           }
         }
       }
       break;
     case eBrightnessChange:
-      {
-        if (int_array_size == 3) {
-          success = true;
-          int param = constrain(packet_int_array[2], 0, 100);
-          received_hardware_index = packet_int_array[1];
-          // update brightness level
-          if ((received_hardware_index == hardware_index) || (received_hardware_index == 0)) {
-            if (param != routines.brightness()) { 
-              should_update_no_speed = true; 
-              routines.brightness(param); 
-            } 
+      if (isStateChangeValid(header)) {
+        success = true;
+        int param = constrain(packet_int_array[2], 0, 100);
+        // update brightness level
+        for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+          DeviceState& device = devices[i];
+          if (isReceivingDevice(device) && (param != device.routines->brightness())) {
+            device.should_update_no_speed = true; 
+            device.routines->brightness(param); 
           }
         }
-        break;
       }
+      break;
     case eIdleTimeoutChange:
-      if (int_array_size == 3) {
+      if (isStateChangeValid(header)) {
         success = true;
-        received_hardware_index = packet_int_array[1];
-        if ((received_hardware_index == hardware_index) || (received_hardware_index == 0)) {
-          unsigned long new_timeout = (unsigned long)packet_int_array[2];
-          idle_timeout = new_timeout * 60 * 1000;
+        unsigned long new_timeout = (unsigned long)packet_int_array[2];
+        for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+          if (isReceivingDevice(devices[i])) {
+            devices[i].idle_timeout = new_timeout * 60 * 1000;
+          }
         }
       }
       break;
     case eCustomColorCountChange:
-      if (int_array_size == 3) {
-        if (packet_int_array[2] > 1) {
-          success = true;
-          received_hardware_index = packet_int_array[1];
-          if ((received_hardware_index == hardware_index) || (received_hardware_index == 0)) {
-            routines.setCustomColorCount(packet_int_array[2]);
+      if (isStateChangeValid(header)) {
+        success = true;
+        ArduCor* shared_routines = NULL;
+        for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+          if (isReceivingDevice(devices[i])) {
+            if (received_hardware_index != 0) {
+              devices[i].routines->setCustomColorCount(packet_int_array[2]);
+            } else if ((shared_routines == NULL)
+                       || !devices[i].routines->sharesCustomColors(*shared_routines)) {
+              devices[i].routines->setSharedCustomColorCount(packet_int_array[2]);
+              if (shared_routines == NULL) {
+                shared_routines = devices[i].routines;
+              }
+            }
           }
         }
       }
       break;
+    case eFrameUpdate:
+      success = frameParser();
+      break;
+    case eSequenceNumber:
+      if ((int_array_size == 2)
+          && (packet_int_array[1] >= 0)
+          && (packet_int_array[1] <= 255)) {
+        // not counted as applied, since it doesn't change a state
+        has_sequence = true;
+        sequence_number = packet_int_array[1];
+      }
+      break;
     case eStateUpdateRequest:
       if (int_array_size == 1) {
         skip_echo = true;
@@ -490,12 +898,22 @@ bool parsePacket(int header)
         Serial.write(state_update_packet);
       }
       break;
+    case eDeltaStateUpdateRequest:
+      if (int_array_size == 3) {
+        skip_echo = true;
+        // Send back only the fields that changed since the client's sequence number
+        buildDeltaStateUpdatePacket(packet_int_array[1], packet_int_array[2]);
+        Serial.write(state_update_packet);
+      }
+      break;
     case eCustomArrayUpdateRequest:
       if (int_array_size == 1) {
         skip_echo = true;
-        // Send back update
-        buildCustomArrayUpdatePacket();
-        Serial.write(state_update_packet);
+        // Send back an update for each device
+        for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+          buildCustomArrayUpdatePacket(devices[i]);
+          Serial.write(state_update_packet);
+        }
       }
       break;
     default:
@@ -504,225 +922,213 @@ bool parsePacket(int header)
   return success;
 }
 
-
 /*!
- * @brief routineParser Parses a routine packet, checking that the received packets are the proper
- *        size and that their values fall into the proper ranges. If they do, this function sets
- *        the values in memory.
- *        
- * @param currentSuccess the current success status of the packet parsing. This will only ever
- *        set the success packet to true
+ * @brief routineParser checks that a routine change message has the right number of values
+ *        for its routine and that each value is in range, then applies it to each device it
+ *        is meant for.
+ *
+ * @param apply false to only check the message.
+ *
+ * @return true if the message is valid, false otherwise.
  */
-bool routineParser(bool currentSuccess)
+bool routineParser(bool apply)
 {
-  bool success = currentSuccess;
   // check theres at least enough information to get a routine and hardware index
   // and check if routine is in a valid range
-  if (int_array_size > 2) {
-      if ((packet_int_array[2] < (int)eRoutine_MAX)
-           && (packet_int_array[1] <= (DEFAULT_HW_INDEX + DEVICE_COUNT - 1))) {
-      // required values
-      received_hardware_index = packet_int_array[1];
-      ERoutine routine        = (ERoutine)packet_int_array[2];
-      bool isValid            = false;
-      reset_counter           = false;
-  
-      // routine specific values
-      EPalette palette        = ePalette_MAX;
-      int speedValue          = 0;
-
-      // check that packets are the correct size and fill in parameters
-      // check if loop counter should reset
-      switch (routine) {
-        case eSingleSolid:
-        {
-          if (int_array_size == 6) {
-            isValid = parseColor(packet_int_array[3],
-                                 packet_int_array[4],
-                                 packet_int_array[5]);
-          }
-          break;
-        }
-        case eSingleBlink:
-        case eSingleWave:     
-        {
-          if (int_array_size == 7) {
-            speedValue = packet_int_array[6];
-            if (speedValue >= 0 && speedValue <= MAX_SPEED_VALUE) {
-              isValid = parseColor(packet_int_array[3],
-                                   packet_int_array[4],
-                                   packet_int_array[5]);           
-            }
-            // check if reset counter
-            if (routine != current_routine) {
-              reset_counter = true;            
-            }
-          }
-          break;
-        }
-        case eSingleFade:
-        case eSingleSawtoothFade:        
-        case eSingleGlimmer:
-        {
-          if (int_array_size == 8) {
-            speedValue = packet_int_array[6];
-
-            // handle the optional parameters
-            if (routine == eSingleFade) {
-              if (speedValue >= 0 
-                  && speedValue <= MAX_SPEED_VALUE
-                  && packet_int_array[7] <= 1) {
-                isValid = parseColor(packet_int_array[3],
-                                     packet_int_array[4],
-                                     packet_int_array[5]);
-                if (packet_int_array[7] != fade_param) {
-                  fade_param = packet_int_array[7];
-                  reset_counter = true;            
-                }
-              }
-            } else if (routine == eSingleSawtoothFade) {
-              if (speedValue >= 0 
-                  && speedValue <= MAX_SPEED_VALUE
-                  && packet_int_array[7] <= 1) {
-                isValid = parseColor(packet_int_array[3],
-                                     packet_int_array[4],
-                                     packet_int_array[5]);
-                if (packet_int_array[7] != sawtooth_param) {
-                  sawtooth_param = packet_int_array[7];
-                  reset_counter = true;            
-                }
-              }
-            } else if (routine == eSingleGlimmer) {
-               if (speedValue >= 0 
-                  && speedValue <= MAX_SPEED_VALUE
-                  && packet_int_array[7] <= 100) {
-                isValid = parseColor(packet_int_array[3],
-                                     packet_int_array[4],
-                                     packet_int_array[5]);
-                if (packet_int_array[7] != single_glimmer_param) {
-                  single_glimmer_param = packet_int_array[7];
-                  reset_counter = true;            
-                }
-              }
-            }
+  if ((int_array_size < 3)
+      || (packet_int_array[2] < 0)
+      || (packet_int_array[2] >= (int)eRoutine_MAX)
+      || (packet_int_array[1] > (DEFAULT_HW_INDEX + DEVICE_COUNT - 1))) {
+    return false;
+  }
+  ERoutine routine = (ERoutine)packet_int_array[2];
+  bool isSingleRoutine = (routine <= eSingleSawtoothFade);
 
-            // check if reset counter
-            if (routine != current_routine) {
-              reset_counter = true;            
-            }
-          }
-          break;
-        } 
-        case eMultiGlimmer:
-        case eMultiBars:
-        {
-          if (int_array_size == 6) {
-            palette = (EPalette)packet_int_array[3];
-            speedValue = packet_int_array[4];
-            isValid = true;
-  
-            if (routine == eMultiGlimmer) {
-              if (speedValue >= 0 
-                  && speedValue <= MAX_SPEED_VALUE
-                  && packet_int_array[5] <= 100) {
-                 isValid = true;
-                 if (packet_int_array[5] != multi_glimmer_param) {
-                    multi_glimmer_param = packet_int_array[5];
-                    reset_counter = true;            
-                 }
-               }
-             } else if (routine == eMultiBars) {
-               if (speedValue >= 0 
-                  && speedValue <= MAX_SPEED_VALUE
-                  && packet_int_array[5] <= 10) {
-                 isValid = true;
-                 if (packet_int_array[5] != multi_bars_param) {
-                   multi_bars_param = packet_int_array[5];
-                   reset_counter = true;            
-                }
-              }
-            }
-            if (speedValue >= 0 && speedValue <= MAX_SPEED_VALUE) {
-              isValid = true;
-              // check if reset counter
-              if (palette != current_palette || routine != current_routine) {
-                reset_counter = true;            
-              }
-            }
-          }
-          break;
-        }
-        case eMultiFade:
-        case eMultiRandomSolid:
-        case eMultiRandomIndividual:
-        {
-          if (int_array_size == 5) {
-            palette = (EPalette)packet_int_array[3];
-            speedValue = packet_int_array[4];
-
-            if (speedValue >= 0 && speedValue <= MAX_SPEED_VALUE) {
-              isValid = true;
-              // check if reset counter
-              if (palette != current_palette || routine != current_routine) {
-                reset_counter = true;            
-              }
-            }
-          }
-          break;
-        }
-        default:
-          break;
+  // check that packets are the correct size for the routine
+  int expectedSize = 5;
+  int maxParam = 0;
+  switch (routine) {
+    case eSingleSolid:
+      expectedSize = 6;
+      break;
+    case eSingleBlink:
+    case eSingleWave:
+      expectedSize = 7;
+      break;
+    case eSingleFade:
+    case eSingleSawtoothFade:
+      expectedSize = 8;
+      maxParam = 1;
+      break;
+    case eSingleGlimmer:
+      expectedSize = 8;
+      maxParam = 100;
+      break;
+    case eMultiGlimmer:
+      expectedSize = 6;
+      maxParam = 100;
+      break;
+    case eMultiBars:
+      expectedSize = 6;
+      maxParam = 10;
+      break;
+    default:
+      break;
+  }
+  if (int_array_size != expectedSize) {
+    return false;
+  }
+
+  // fill in parameters and check that they are in range
+  int speedValue = 0;
+  int param = 0;
+  EPalette palette = ePalette_MAX;
+  if (isSingleRoutine) {
+    for (uint8_t i = 3; i < 6; ++i) {
+      if ((packet_int_array[i] < 0) || (packet_int_array[i] > 255)) {
+        return false;
       }
-      // if the packet was valid, do some final checks
-      if (isValid) {
-        // update stored values
-        if ((received_hardware_index == hardware_index) || (received_hardware_index == 0)) {
-          if (routine == eSingleSolid) {
-            // check reset counter
-            if (routine != current_routine) {
-              reset_counter = true;            
-            }
-            current_routine = routine;
-          } else if ((speedValue >= 0 && speedValue <= MAX_SPEED_VALUE)) {
-            update_speed = speedValue;
-            current_routine = routine;
-            if (routine > eSingleSawtoothFade) {
-              current_palette = palette;
-            }
-          }
-        }
-        
-        if (reset_counter) {
-          // Reset to 0 to draw to screen right away
-          loop_counter = 0;
-          if ((received_hardware_index == hardware_index) || (received_hardware_index == 0)) {
-            should_update_no_speed = true;            
-          }
-        }     
-        success = true;
+    }
+    if (routine != eSingleSolid) {
+      speedValue = packet_int_array[6];
+    }
+    if (expectedSize == 8) {
+      param = packet_int_array[7];
+    }
+  } else {
+    if ((packet_int_array[3] < 0) || (packet_int_array[3] >= (int)ePalette_MAX)) {
+      return false;
+    }
+    palette = (EPalette)packet_int_array[3];
+    speedValue = packet_int_array[4];
+    if (expectedSize == 6) {
+      param = packet_int_array[5];
+    }
+  }
+  if ((speedValue < 0) || (speedValue > MAX_SPEED_VALUE)
+      || (param < 0) || (param > maxParam)) {
+    return false;
+  }
+  if (!apply) {
+    return true;
+  }
+
+  // update stored values, and check if loop counter should reset
+  for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+    DeviceState& device = devices[i];
+    if (!isReceivingDevice(device)) {
+      continue;
+    }
+    bool reset_counter = (routine != device.current_routine);
+    if (isSingleRoutine) {
+      if (device.routines->setMainColor(packet_int_array[3],
+                                        packet_int_array[4],
+                                        packet_int_array[5])) {
+        reset_counter = true;
       }
-    } 
+    } else if (palette != device.current_palette) {
+      reset_counter = true;
+      device.current_palette = palette;
+    }
+
+    // handle the optional parameters
+    switch (routine) {
+      case eSingleFade:
+        reset_counter |= (param != device.fade_param);
+        device.fade_param = param;
+        break;
+      case eSingleSawtoothFade:
+        reset_counter |= (param != device.sawtooth_param);
+        device.sawtooth_param = param;
+        break;
+      case eSingleGlimmer:
+        reset_counter |= (param != device.single_glimmer_param);
+        device.single_glimmer_param = param;
+        break;
+      case eMultiGlimmer:
+        reset_counter |= (param != device.multi_glimmer_param);
+        device.multi_glimmer_param = param;
+        break;
+      case eMultiBars:
+        reset_counter |= (param != device.multi_bars_param);
+        device.multi_bars_param = param;
+        break;
+      default:
+        break;
+    }
+
+    if (device.is_streaming) {
+      // the device runs its own routines again, so start the routine from scratch.
+      device.is_streaming = false;
+      reset_counter = true;
+    }
+    device.current_routine = routine;
+    if (routine != eSingleSolid) {
+      device.update_speed = speedValue;
+    }
+    if (reset_counter) {
+      // Reset to 0 to draw to screen right away
+      loop_counter = 0;
+      device.should_update_no_speed = true;            
+    }
   }
-  return success;
+  return true;
 }
 
-bool parseColor(int red, int green, int blue) {
-  bool success = false;
-  // first check if the values are in a valid range
-  if (red >= 0 && red <= 255
-      || green >= 0 && green <= 255
-      || blue >= 0 && blue <= 255) {
-      if ((received_hardware_index == hardware_index) || (received_hardware_index == 0)) {
-        if (red != routines.mainColor().red
-            || green != routines.mainColor().green
-            || blue  != routines.mainColor().blue) {
-          reset_counter = true;
-          routines.setMainColor(red, green, blue);
-        }
+/*!
+ * @brief frameParser checks that a frame update message is made of complete runs that fit
+ *        in the LEDs of a device, then draws the runs to each device it is meant for.
+ *        A frame update is `9,hardwareIndex,startIndex,count,r,g,b` with up to two more
+ *        runs of `count,r,g,b` after the first. Frames are never echoed.
+ *
+ * @return true if the message is valid, false otherwise.
+ */
+bool frameParser()
+{
+  if ((int_array_size < 7) || (((int_array_size - 3) % 4) != 0)) {
+    return false;
+  }
+  // each value is checked against the LED count before it is added, so the sum can't overflow.
+  int ledIndex = packet_int_array[2];
+  if ((ledIndex < 0) || (ledIndex > (LED_COUNT / DEVICE_COUNT))) {
+    return false;
+  }
+  for (uint8_t i = 3; i < int_array_size; i += 4) {
+    if ((packet_int_array[i] <= 0) || (packet_int_array[i] > (LED_COUNT / DEVICE_COUNT))) {
+      return false;
+    }
+    ledIndex += packet_int_array[i];
+    for (uint8_t j = i + 1; j < i + 4; ++j) {
+      if ((packet_int_array[j] < 0) || (packet_int_array[j] > 255)) {
+        return false;
       }
-    success = true;
+    }
   }
-  return success;
+  if (ledIndex > (LED_COUNT / DEVICE_COUNT)) {
+    return false;
+  }
+
+  skip_echo = true;
+  for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+    DeviceState& device = devices[i];
+    if (!isReceivingDevice(device)) {
+      continue;
+    }
+    // the host handles brightness and on/off itself, so the frame is drawn as is.
+    device.routines->turnOn();
+    device.is_streaming = true;
+    device.should_update_no_speed = true;
+    ledIndex = packet_int_array[2];
+    for (uint8_t run = 3; run < int_array_size; run += 4) {
+      for (int led = 0; led < packet_int_array[run]; ++led) {
+        device.routines->drawColor(ledIndex++,
+                                   packet_int_array[run + 1],
+                                   packet_int_array[run + 2],
+                                   packet_int_array[run + 3]);
+      }
+    }
+  }
+  return true;
 }
 
 
@@ -730,134 +1136,165 @@ bool parseColor(int red, int green, int blue) {
 // State Update
 //================================================================================
 
+/*!
+ * @brief readStateFields fills an array with the values of a device's state update message
+ *        that follow its hardware index.
+ *
+ * @param device the device to read.
+ * @param fields array of STATE_FIELD_COUNT values to fill.
+ */
+void readStateFields(const DeviceState& device, uint16_t* fields)
+{
+  ArduCor* lights = device.routines;
+  fields[0]  = lights->isOn();
+  fields[1]  = 1; // isReachable
+  fields[2]  = lights->mainColor().red;
+  fields[3]  = lights->mainColor().green;
+  fields[4]  = lights->mainColor().blue;
+  fields[5]  = device.current_routine;
+  fields[6]  = device.current_palette;
+  fields[7]  = lights->brightness();
+  fields[8]  = device.update_speed;
+  fields[9]  = device.idle_timeout / 60000;
+  fields[10] = calculateMinutesUntilTimeout(last_message_time, device.idle_timeout);
+}
+
 void buildStateUpdatePacket() 
 {
-  memset(state_update_packet, 0, sizeof(state_update_packet));
-
-  strcat(state_update_packet, itoa((uint8_t)eStateUpdateRequest, num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa((uint8_t)hardware_index, num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa((uint8_t)routines.isOn(), num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa(1, num_buf, 10)); // isReachable
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa(routines.mainColor().red, num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa(routines.mainColor().green, num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa(routines.mainColor().blue, num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa((uint8_t)current_routine, num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa((uint8_t)current_palette, num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa(routines.brightness(), num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa(update_speed, num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa(idle_timeout / 60000, num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa(calculateMinutesUntilTimeout(last_message_time, idle_timeout), num_buf, 10));
-  strcat(state_update_packet, message_delimiter);
-
-
-  // add the crc
-  if (USE_CRC) {
-    unsigned long crc = crcCalculator(state_update_packet);
-    strcat(state_update_packet, crc_delimiter);
-    strcat(state_update_packet, ultoa(crc, num_buf, 10));
-    strcat(state_update_packet, message_delimiter);
-   }  
-  strcat(state_update_packet, packet_delimiter);
-  // add the newline
-  if (USE_NEWLINE) {
-    strcat(state_update_packet, new_line);
+  uint16_t fields[STATE_FIELD_COUNT];
+  packet_writer.begin(state_update_packet, sizeof(state_update_packet));
+
+  for (uint8_t device = 0; device < DEVICE_COUNT; ++device) {
+    readStateFields(devices[device], fields);
+    packet_writer.writeValue((uint8_t)eStateUpdateRequest);
+    packet_writer.writeNumber(devices[device].hardware_index);
+    for (uint8_t i = 0; i < STATE_FIELD_COUNT; ++i) {
+      packet_writer.write(',');
+      packet_writer.writeNumber(fields[i]);
+    }
+    packet_writer.write('&');
   }
 
+  packet_writer.end(USE_CRC);
 }
 
-
-void buildCustomArrayUpdatePacket() 
+/*!
+ * @brief buildDeltaStateUpdatePacket builds a state update that only contains the fields
+ *        that changed since the last delta state update. Each device's message is either
+ *        `8,hardwareIndex,sequence&` if nothing changed, or `8,hardwareIndex,sequence,mask,...&`
+ *        followed by the value of each field that has its bit set in the mask. If the client's
+ *        sequence number is not the device's current sequence number, every field is sent.
+ *
+ * @param requestedIndex hardware index to send updates for, 0 for all devices.
+ * @param clientSequence the sequence number the client last received for the device.
+ */
+void buildDeltaStateUpdatePacket(uint8_t requestedIndex, uint8_t clientSequence) 
 {
-  memset(state_update_packet, 0, sizeof(state_update_packet));
+  uint16_t fields[STATE_FIELD_COUNT];
+  packet_writer.begin(state_update_packet, sizeof(state_update_packet));
 
-  strcat(state_update_packet, itoa((uint8_t)eCustomArrayUpdateRequest, num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa((uint8_t)hardware_index, num_buf, 10));
-  strcat(state_update_packet, value_delimiter);
-  strcat(state_update_packet, itoa((uint8_t)routines.customColorCount(), num_buf, 10));
-  for (int i = 0; i < routines.customColorCount(); ++i) {
-    strcat(state_update_packet, value_delimiter);
-    strcat(state_update_packet, itoa(routines.color(i).red, num_buf, 10));
-    strcat(state_update_packet, value_delimiter);
-    strcat(state_update_packet, itoa(routines.color(i).green, num_buf, 10));
-    strcat(state_update_packet, value_delimiter);
-    strcat(state_update_packet, itoa(routines.color(i).blue, num_buf, 10));
+  for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+    DeviceState& device = devices[i];
+    if ((requestedIndex != device.hardware_index) && (requestedIndex != 0)) {
+      continue;
+    }
+    readStateFields(device, fields);
+    uint16_t change_mask = 0;
+    for (uint8_t field = 0; field < STATE_FIELD_COUNT; ++field) {
+      uint16_t snapshot = (field < STATE_BYTE_FIELD_COUNT) ? device.state_snapshot[field]
+                          : device.timeout_snapshot[field - STATE_BYTE_FIELD_COUNT];
+      if ((clientSequence != device.state_sequence) || (fields[field] != snapshot)) {
+        change_mask |= (1 << field);
+      }
+    }
+    if (change_mask != 0) {
+      // the client's view is out of date, so start a new sequence for the state it is sent
+      ++device.state_sequence;
+      if (device.state_sequence == 0) {
+        device.state_sequence = 1;
+      }
+      for (uint8_t field = 0; field < STATE_BYTE_FIELD_COUNT; ++field) {
+        device.state_snapshot[field] = fields[field];
+      }
+      device.timeout_snapshot[0] = fields[STATE_BYTE_FIELD_COUNT];
+      device.timeout_snapshot[1] = fields[STATE_BYTE_FIELD_COUNT + 1];
+    }
+
+    packet_writer.writeValue((uint8_t)eDeltaStateUpdateRequest);
+    packet_writer.writeValue(device.hardware_index);
+    packet_writer.writeNumber(device.state_sequence);
+    if (change_mask != 0) {
+      packet_writer.write(',');
+      packet_writer.writeNumber(change_mask);
+      for (uint8_t field = 0; field < STATE_FIELD_COUNT; ++field) {
+        if (change_mask & (1 << field)) {
+          packet_writer.write(',');
+          packet_writer.writeNumber(fields[field]);
+        }
+      }
+    }
+    packet_writer.write('&');
   }
-  strcat(state_update_packet, message_delimiter);
 
-  // add the crc
-  if (USE_CRC) {
-    unsigned long crc = crcCalculator(state_update_packet);
-    strcat(state_update_packet, crc_delimiter);
-    strcat(state_update_packet, ultoa(crc, num_buf, 10));
-    strcat(state_update_packet, message_delimiter);
-  }  
+  packet_writer.end(USE_CRC);
+}
+
 
-  strcat(state_update_packet, packet_delimiter);
-  // add the newline
-  if (USE_NEWLINE) {
-      strcat(state_update_packet, new_line);
+void buildCustomArrayUpdatePacket(const DeviceState& device) 
+{
+  ArduCor* lights = device.routines;
+  packet_writer.begin(state_update_packet, sizeof(state_update_packet));
+
+  packet_writer.writeValue((uint8_t)eCustomArrayUpdateRequest);
+  packet_writer.writeValue(device.hardware_index);
+  packet_writer.writeNumber((uint8_t)lights->customColorCount());
+  for (int i = 0; i < lights->customColorCount(); ++i) {
+    packet_writer.write(',');
+    packet_writer.writeValue(lights->color(i).red);
+    packet_writer.writeValue(lights->color(i).green);
+    packet_writer.writeNumber(lights->color(i).blue);
   }
-}
+  packet_writer.write('&');
 
+  packet_writer.end(USE_CRC);
+}
 
 void buildDiscoveryPacket()
 {
-  strcat(discovery_packet, "DISCOVERY_PACKET");
-  strcat(discovery_packet, value_delimiter);
-  strcat(discovery_packet, itoa((uint8_t)API_LEVEL_MAJOR, num_buf, 10));
-  strcat(discovery_packet, value_delimiter);
-  strcat(discovery_packet, itoa((uint8_t)API_LEVEL_MINOR, num_buf, 10));
-  strcat(discovery_packet, value_delimiter);
-  strcat(discovery_packet, itoa((uint8_t)USE_CRC, num_buf, 10));
-  strcat(discovery_packet, value_delimiter);
-  strcat(discovery_packet, itoa((uint8_t)0, num_buf, 10)); // Hardware Capabilities flag (0 for arduino, 1 for raspberry pi)
-  strcat(discovery_packet, value_delimiter);
-  strcat(discovery_packet, itoa((uint8_t)max_packet_size, num_buf, 10));
-  strcat(discovery_packet, value_delimiter);
-  strcat(discovery_packet, itoa((uint8_t)DEVICE_COUNT, num_buf, 10));
-  strcat(discovery_packet, names_delimiter);
-  strcat(discovery_packet, name_buffer);
-  strcat(discovery_packet, value_delimiter);
-  strcat(discovery_packet, itoa((uint8_t)light_type, num_buf, 10));
-  strcat(discovery_packet, value_delimiter);
-  strcat(discovery_packet, itoa((uint8_t)product_type, num_buf, 10));
-  strcat(discovery_packet, message_delimiter);
-
-  strcat(discovery_packet, packet_delimiter);
-  // add the newline
-  if (USE_NEWLINE) {
-    strcat(discovery_packet, new_line);
+  packet_writer.begin(discovery_packet, sizeof(discovery_packet));
+
+  packet_writer.write("DISCOVERY_PACKET,");
+  packet_writer.writeValue((uint8_t)API_LEVEL_MAJOR);
+  packet_writer.writeValue((uint8_t)API_LEVEL_MINOR);
+  packet_writer.writeValue((uint8_t)(USE_CRC ? CHECKSUM_TYPES : eNoChecksum)); // supported checksums
+  packet_writer.writeValue((uint8_t)0); // Hardware Capabilities flag (0 for arduino, 1 for raspberry pi)
+  packet_writer.writeValue((uint8_t)max_packet_size);
+  packet_writer.writeNumber((uint8_t)DEVICE_COUNT);
+  packet_writer.write('@');
+  for (uint8_t i = 0; i < DEVICE_COUNT; ++i) {
+    if (i > 0) {
+      packet_writer.write(',');
+    }
+    packet_writer.write(name_buffer);
+    if (i > 0) {
+      // every device after the first adds its hardware index to the name
+      packet_writer.write(' ');
+      packet_writer.writeNumber(devices[i].hardware_index);
+    }
+    packet_writer.write(',');
+    packet_writer.writeValue((uint8_t)light_type);
+    packet_writer.writeNumber((uint8_t)product_type);
   }
+  packet_writer.write('&');
+
+  // discovery packets never use a checksum
+  packet_writer.end(false);
 }
 
 void echoPacket()
 {  
-  // add the crc
-  if (USE_CRC) {
-    unsigned long crc = crcCalculator(echo_message);
-    strcat(echo_message, crc_delimiter);
-    strcat(echo_message, ultoa(crc, num_buf, 10));
-    strcat(echo_message, message_delimiter);
-   }  
-  
-  strcat(echo_message, packet_delimiter);
-  // add the newline
-  if (USE_NEWLINE) {
-    strcat(echo_message, new_line);
-  }
+  // echo_writer holds the echo_message, so finish it with its checksum
+  echo_writer.end(USE_CRC);
   Serial.write(echo_message);
 }
 
@@ -939,7 +1376,7 @@ bool checkIfPacketIsValid(char* message)
     // get a char array of the CRC
     char* crcASCII = strtok(0, "&");
     // compute the CRC of the full packet
-    unsigned long computedCRC = crcCalculator(message);
+    unsigned long computedCRC = checksumCalculator(message);
     // grab the unsigned long value of the crc
     unsigned long givenCRC = strtoul(crcASCII, NULL, 0);
     if (computedCRC == givenCRC) {
@@ -955,6 +1392,128 @@ bool checkIfPacketIsValid(char* message)
   }
 }
 
+/*!
+ *  @brief splitMessages replaces each "&" in a packet with a null terminator, so each
+ *         message can be read as its own string.
+ *
+ * @param packet the packet, without its checksum.
+ *
+ * @return pointer to the end of the packet.
+ */
+char* splitMessages(char* packet)
+{
+  char* end = packet;
+  while (*end != 0) {
+    if (*end == '&') {
+      *end = 0;
+    }
+    ++end;
+  }
+  return end;
+}
+
+/*!
+ *  @brief readMessageKey reads the values that identify what a message changes without
+ *         modifying the message.
+ *
+ * @param message a single null terminated message.
+ * @param key filled with the first three values of the message.
+ *
+ * @return the number of values in the message.
+ */
+uint8_t readMessageKey(const char* message, int* key)
+{
+  uint8_t count = 0;
+  while (message != 0) {
+    if (count < 3) {
+      key[count] = atoi(message);
+    }
+    ++count;
+    message = strchr(message, ',');
+    if (message != 0) {
+      ++message;
+    }
+  }
+  return count;
+}
+
+/*!
+ *  @brief isStateChangeValid checks that the message in packet_int_array is a valid change
+ *         of a state, without applying it. parsePacket only applies changes that pass it.
+ *
+ * @param header the header of the message.
+ *
+ * @return true if the message is a valid state change, false otherwise.
+ */
+bool isStateChangeValid(int header)
+{
+  switch (header)
+  {
+    case eOnOffChange:
+    case eBrightnessChange:
+    case eIdleTimeoutChange:
+      return (int_array_size == 3);
+    case eModeChange:
+      return routineParser(false);
+    case eCustomArrayColorChange:
+      return (int_array_size == 6)
+             && (packet_int_array[2] >= 0)
+             && (packet_int_array[2] < eRoutine_MAX);
+    case eCustomColorCountChange:
+      return (int_array_size == 3) && (packet_int_array[2] > 1);
+    default:
+      return false;
+  }
+}
+
+/*!
+ *  @brief isMessageOverwritten checks if the message in packet_int_array is overwritten
+ *         by a later message in the same packet. A message is overwritten if a later valid
+ *         message has the same header, size, and hardware index (or 0), and changes the same
+ *         routine or custom color. Only messages that change a state are overwritten, requests
+ *         are always answered. The later messages are parsed into packet_int_array to check
+ *         them, so the message is parsed again if it isn't overwritten.
+ *
+ * @param message the current message.
+ * @param nextMessage the message that follows the current message.
+ * @param packetEnd pointer to the end of the packet.
+ *
+ * @return true if a later message overwrites the message, false otherwise.
+ */
+bool isMessageOverwritten(const char* message, const char* nextMessage, const char* packetEnd)
+{
+  int header = packet_int_array[0];
+  // a message that isn't valid is never applied, so it is never skipped as applied either
+  if ((header > eIdleTimeoutChange) || (int_array_size < 3) || !isStateChangeValid(header)) {
+    return false;
+  }
+  uint8_t size = int_array_size;
+  int hardwareIndex = packet_int_array[1];
+  int index = packet_int_array[2];
+  bool isOverwritten = false;
+  bool isParsed = false;
+  int key[3];
+  while (!isOverwritten && (nextMessage < packetEnd)) {
+    if ((readMessageKey(nextMessage, key) == size)
+        && (key[0] == header)
+        && ((key[1] == hardwareIndex) || (key[1] == 0))
+        && (((header != eModeChange) && (header != eCustomArrayColorChange))
+            || (key[2] == index))) {
+      // a later message that isn't valid is skipped, so it can't overwrite anything
+      strcpy(temp_packet, nextMessage);
+      delimitedStringToIntArray(temp_packet);
+      isParsed = true;
+      isOverwritten = isStateChangeValid(header);
+    }
+    nextMessage += strlen(nextMessage) + 1;
+  }
+  if (isParsed && !isOverwritten) {
+    strcpy(temp_packet, message);
+    delimitedStringToIntArray(temp_packet);
+  }
+  return isOverwritten;
+}
+
 /*!
  *  @brief delimitedStringToIntArray takes a char array and fills the packet_int_array
  *         variable with the integer representation of these packets. By this point in message parsing,
@@ -0,0 +1,583 @@
+#------------------------------------------------------------
+# HostRenderer.py
+#------------------------------------------------------------
+# Version 1.3
+# October 17, 2026
+# MIT License (in root of git repo)
+# by Tim Seemann
+#
+#
+# Runs the ArduCor lighting routines on the computer running
+# UDPtoSerialAdapter.py, using the libArduCorRenderer.so built from
+# the renderer folder. Each RenderedDevice keeps the same state that an
+# arduino sample keeps for a lighting device: it applies the messages
+# that change the state, answers requests for it, and renders its
+# routine into frame update messages for the arduino.
+#
+#------------------------------------------------------------
+
+
+#-----
+# imports
+import ctypes
+import os
+import time
+
+# Header values of the messages a RenderedDevice handles, the same as EPacketHeader
+onOffPacketHeader = 0
+modeChangePacketHeader = 1
+customArrayColorPacketHeader = 2
+brightnessPacketHeader = 3
+customColorCountPacketHeader = 4
+idleTimeoutPacketHeader = 5
+stateUpdatePacketHeader = 6
+customColorUpdatePacketHeader = 7
+deltaStateUpdatePacketHeader = 8
+frameUpdatePacketHeader = 9
+# Routines, the same as ERoutine
+singleSolidRoutine = 0
+singleBlinkRoutine = 1
+singleWaveRoutine = 2
+singleGlimmerRoutine = 3
+singleFadeRoutine = 4
+singleSawtoothFadeRoutine = 5
+multiGlimmerRoutine = 6
+multiRandomSolidRoutine = 8
+multiRandomIndividualRoutine = 9
+multiBarsRoutine = 10
+routineCount = 11
+# routines that draw random numbers, so two devices running them never look the same
+randomRoutines = [singleGlimmerRoutine, multiGlimmerRoutine,
+                  multiRandomSolidRoutine, multiRandomIndividualRoutine]
+# Palettes, the same as EPalette
+customPalette = 0
+paletteCount = 17
+# Defaults of the arduino samples
+loopInterval = 0.01 # DELAY_VALUE, in seconds
+maxSpeedValue = 200
+defaultSpeed = 100
+glimmerPercent = 10
+barSize = 4
+defaultTimeout = 120
+stateFieldCount = 11
+# routine updates run at once when a frame is rendered after a long wait. Older updates
+# would never be seen, so only the newest are run.
+maxCatchUpUpdates = 20
+# runs in a single frame update message, so it stays within the 15 values an arduino parses.
+maxRunsPerFrameMessage = 3
+# bytes all RoutineRenderers may keep together of the frames of singleWave and multiBars,
+# which repeat, so that each frame is only computed once. Each RoutineRenderer gets an equal
+# share, see balanceFrameCaches.
+frameCacheSize = 64 * 1024 * 1024
+# the RoutineRenderers that haven't been released, which share frameCacheSize
+liveRenderers = []
+
+#-----
+# Loads libArduCorRenderer.so and describes its functions to ctypes.
+def loadLibrary(path=None):
+    if path is None:
+        path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                            "renderer", "libArduCorRenderer.so")
+    library = ctypes.CDLL(path)
+    handle = ctypes.c_void_p
+    byte = ctypes.c_uint8
+    library.arducorCreate.restype = handle
+    library.arducorCreate.argtypes = [ctypes.c_uint16]
+    library.arducorDestroy.argtypes = [handle]
+    library.arducorSetFrameCache.argtypes = [handle, ctypes.c_uint32]
+    library.arducorTurnOn.argtypes = [handle]
+    library.arducorTurnOff.argtypes = [handle]
+    library.arducorIsOn.restype = ctypes.c_bool
+    library.arducorIsOn.argtypes = [handle]
+    library.arducorSetMainColor.restype = ctypes.c_bool
+    library.arducorSetMainColor.argtypes = [handle, byte, byte, byte]
+    library.arducorSetColor.argtypes = [handle, ctypes.c_uint16, byte, byte, byte]
+    library.arducorSetCustomColorCount.argtypes = [handle, byte]
+    library.arducorCustomColorCount.restype = byte
+    library.arducorCustomColorCount.argtypes = [handle]
+    library.arducorSetBrightness.argtypes = [handle, byte]
+    library.arducorBrightness.restype = ctypes.c_int
+    library.arducorBrightness.argtypes = [handle]
+    library.arducorColor.argtypes = [handle, ctypes.c_int, ctypes.POINTER(byte)]
+    library.arducorUpdateRoutine.argtypes = [handle, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+    library.arducorReadFrame.argtypes = [handle, ctypes.c_uint16, ctypes.POINTER(byte)]
+    library.arducorCopyState.restype = ctypes.c_bool
+    library.arducorCopyState.argtypes = [handle, handle]
+    library.arducorHasSameState.restype = ctypes.c_bool
+    library.arducorHasSameState.argtypes = [handle, handle]
+    return library
+
+#-----
+# Gives each live RoutineRenderer an equal share of frameCacheSize. A RoutineRenderer whose
+# cache is over its share gets the largest power of two within it. Changing the size starts
+# a cache over, so a cache is only grown once the share is 4 times its size, and renderers
+# that are copied and shared again near a power of two don't keep starting over.
+def balanceFrameCaches():
+    share = frameCacheSize / max(len(liveRenderers), 1)
+    size = 1
+    while size * 2 <= share:
+        size = size * 2
+    if share == 0:
+        size = 0
+    for renderer in liveRenderers:
+        if renderer.frameCacheLimit > share or renderer.frameCacheLimit * 4 <= share:
+            renderer.frameCacheLimit = size
+            renderer.library.arducorSetFrameCache(renderer.routines, size)
+
+#-----
+# Splits the LEDs in changedRanges into runs of the same color and packs the runs
+# into frame update messages. Each range is a (start, end) pair of LED indices. A
+# message holds as many runs as fit in maxMessageLength characters, and at least one.
+def frameUpdateMessages(hardwareIndex, frame, changedRanges, maxMessageLength):
+    messages = []
+    for (start, end) in changedRanges:
+        runs = []
+        i = start
+        while i < end:
+            color = frame[i * 3 : i * 3 + 3]
+            j = i + 1
+            while j < end and frame[j * 3 : j * 3 + 3] == color:
+                j = j + 1
+            runs.append((j - i, color))
+            i = j
+        ledIndex = start
+        message = None
+        runCount = 0
+        for (count, color) in runs:
+            run = ",%d,%d,%d,%d" % (count, color[0], color[1], color[2])
+            if message is None or runCount == maxRunsPerFrameMessage \
+                or len(message) + len(run) > maxMessageLength:
+                if message is not None:
+                    messages.append(message)
+                message = "%d,%d,%d" % (frameUpdatePacketHeader, hardwareIndex, ledIndex)
+                runCount = 0
+            message += run
+            runCount = runCount + 1
+            ledIndex = ledIndex + count
+        if message is not None:
+            messages.append(message)
+    return messages
+
+#-----
+# Runs a routine with the library for one or more RenderedDevices. Devices whose routine,
+# settings and progress are the same share a RoutineRenderer, so the routine is run and
+# its frames are read and split into messages once for all of them. A device that changes
+# a shared RoutineRenderer gets its own copy first.
+class RoutineRenderer:
+
+    #-----
+    # Starts with the defaults of the arduino samples.
+    def __init__(self, library, ledCount):
+        self.library = library
+        self.ledCount = ledCount
+        self.routines = library.arducorCreate(ledCount)
+        self.frameCacheLimit = 0
+        liveRenderers.append(self)
+        balanceFrameCaches()
+        self.users = 1
+        self.routine = singleGlimmerRoutine
+        self.palette = customPalette
+        self.speed = defaultSpeed
+        self.shouldUpdateNoSpeed = False
+        self.params = { singleGlimmerRoutine : glimmerPercent,
+                        multiGlimmerRoutine : glimmerPercent,
+                        singleSawtoothFadeRoutine : 0,
+                        singleFadeRoutine : 0,
+                        multiBarsRoutine : barSize }
+        self.loopCounter = 0
+        self.lastLoopTime = time.time()
+        self.frameBuffer = (ctypes.c_uint8 * (ledCount * 3))()
+        # the LEDs as of the last update, None until they are read
+        self.frame = None
+        # frame update messages built from self.frame, see RenderedDevice.frameMessages
+        self.frameMessageCache = []
+
+    #-----
+    # A new RoutineRenderer that continues from this one.
+    def copy(self):
+        renderer = RoutineRenderer(self.library, self.ledCount)
+        self.library.arducorCopyState(renderer.routines, self.routines)
+        renderer.routine = self.routine
+        renderer.palette = self.palette
+        renderer.speed = self.speed
+        renderer.shouldUpdateNoSpeed = self.shouldUpdateNoSpeed
+        renderer.params = dict(self.params)
+        renderer.loopCounter = self.loopCounter
+        renderer.lastLoopTime = self.lastLoopTime
+        return renderer
+
+    #-----
+    # Called by each device that stops using this RoutineRenderer.
+    def release(self):
+        self.users = self.users - 1
+        if self.users == 0:
+            self.library.arducorDestroy(self.routines)
+            liveRenderers.remove(self)
+            balanceFrameCaches()
+
+    #-----
+    # True if this RoutineRenderer shows the same frames as another one from now on.
+    # Routines that use random numbers never do, since the library draws them from a
+    # single stream.
+    def looksLike(self, other):
+        return self.routine not in randomRoutines \
+            and self.ledCount == other.ledCount \
+            and self.routine == other.routine \
+            and self.palette == other.palette \
+            and self.params.get(self.routine, 0) == other.params.get(other.routine, 0) \
+            and self.speed == other.speed \
+            and self.shouldUpdateNoSpeed == other.shouldUpdateNoSpeed \
+            and self.loopCounter == other.loopCounter \
+            and abs(self.lastLoopTime - other.lastLoopTime) < loopInterval \
+            and self.library.arducorHasSameState(self.routines, other.routines)
+
+    #-----
+    # Starts the routine over, so its next update is drawn right away.
+    def resetLoopCounter(self):
+        self.loopCounter = 0
+        self.lastLoopTime = time.time() - loopInterval
+        self.shouldUpdateNoSpeed = True
+
+    #-----
+    # Runs the routine for each loop the arduino samples would have run since the last
+    # render. Devices that share this RoutineRenderer all call this, and only the first
+    # call after a loop runs it.
+    def render(self, now):
+        loops = int((now - self.lastLoopTime) / loopInterval)
+        if loops > 0:
+            self.lastLoopTime += loops * loopInterval
+            updates = 0
+            if self.speed == 0:
+                if self.shouldUpdateNoSpeed:
+                    updates = 1
+            else:
+                # loop counters in this range that are a multiple of the update period
+                period = (maxSpeedValue + 5) - self.speed
+                updates = (self.loopCounter + loops - 1) / period - (self.loopCounter - 1) / period
+            self.shouldUpdateNoSpeed = False
+            self.loopCounter += loops
+            for x in range(min(updates, maxCatchUpUpdates)):
+                self.library.arducorUpdateRoutine(self.routines, self.routine, self.palette,
+                                                  self.params.get(self.routine, 0))
+            if updates > 0:
+                self.changed()
+
+    #-----
+    # Called after anything that may change the LEDs.
+    def changed(self):
+        self.frame = None
+        self.frameMessageCache = []
+
+    #-----
+    # The LEDs as they would be shown, three bytes per LED in red, green, blue order.
+    # The frame isn't changed once it is returned, so it can be kept as the last frame sent.
+    def readFrame(self):
+        if self.frame is None:
+            self.library.arducorReadFrame(self.routines, self.ledCount, self.frameBuffer)
+            self.frame = bytearray(self.frameBuffer)
+        return self.frame
+
+#-----
+# A lighting device whose routines are rendered on this computer.
+class RenderedDevice:
+
+    #-----
+    # Starts with the defaults of the arduino samples. A state update message from the
+    # arduino, split into its values, can be given to continue from the arduino's state.
+    def __init__(self, library, hardwareIndex, ledCount, stateUpdateValues=None):
+        self.library = library
+        self.hardwareIndex = hardwareIndex
+        self.ledCount = ledCount
+        self.renderer = RoutineRenderer(library, ledCount)
+        self.idleTimeout = defaultTimeout * 60
+        self.stateSequence = 1
+        self.stateSnapshot = [0] * stateFieldCount
+        self.lastMessageTime = time.time()
+        self.sentFrame = None
+        library.arducorSetMainColor(self.renderer.routines, 0, 127, 0)
+        if stateUpdateValues is not None:
+            self.applyStateUpdate(stateUpdateValues)
+
+    #-----
+    # The RoutineRenderer of this device, copied first if it is shared, so that it can be
+    # changed without changing other devices.
+    def writableRenderer(self):
+        if self.renderer.users > 1:
+            renderer = self.renderer.copy()
+            self.renderer.release()
+            self.renderer = renderer
+        self.renderer.changed()
+        return self.renderer
+
+    #-----
+    # Shows the routine of another device that looks the same, instead of its own.
+    def share(self, other):
+        if self.renderer is other.renderer:
+            return
+        self.renderer.release()
+        self.renderer = other.renderer
+        self.renderer.users = self.renderer.users + 1
+
+    #-----
+    # Stops using the library, once the device is no longer rendered.
+    def release(self):
+        self.renderer.release()
+
+    #-----
+    # Takes the state in a state update message from the arduino
+    def applyStateUpdate(self, values):
+        try:
+            values = [int(value) for value in values]
+        except ValueError:
+            return
+        if len(values) != stateFieldCount + 2:
+            return
+        renderer = self.writableRenderer()
+        self.library.arducorSetMainColor(renderer.routines, values[4], values[5], values[6])
+        if values[7] < routineCount:
+            renderer.routine = values[7]
+        if values[8] < paletteCount:
+            renderer.palette = values[8]
+        self.library.arducorSetBrightness(renderer.routines, values[9])
+        renderer.speed = values[10]
+        self.idleTimeout = values[11] * 60
+        if values[2] == 0:
+            self.library.arducorTurnOff(renderer.routines)
+        renderer.resetLoopCounter()
+
+    #-----
+    # Applies a message that changes the state, split into its values. The message must
+    # be meant for this device. Returns True if the message is valid, in which case the
+    # arduino samples would echo it.
+    def parseMessage(self, values):
+        try:
+            values = [int(value) for value in values]
+        except ValueError:
+            return False
+        header = values[0]
+        success = False
+        if header == onOffPacketHeader and len(values) == 3:
+            success = True
+            if values[2] == 0:
+                self.library.arducorTurnOff(self.writableRenderer().routines)
+            elif values[2] == 1:
+                renderer = self.writableRenderer()
+                renderer.resetLoopCounter()
+                self.library.arducorTurnOn(renderer.routines)
+        elif header == modeChangePacketHeader:
+            success = self.parseRoutine(values)
+        elif header == customArrayColorPacketHeader and len(values) == 6:
+            if values[2] >= 0 and values[2] < routineCount:
+                success = True
+                renderer = self.writableRenderer()
+                if renderer.routine > singleSawtoothFadeRoutine and renderer.palette == customPalette:
+                    renderer.resetLoopCounter()
+                self.library.arducorSetColor(renderer.routines, values[2],
+                                             values[3] & 0xFF, values[4] & 0xFF, values[5] & 0xFF)
+        elif header == brightnessPacketHeader and len(values) == 3:
+            success = True
+            brightness = min(max(values[2], 0), 100)
+            if brightness != self.library.arducorBrightness(self.renderer.routines):
+                renderer = self.writableRenderer()
+                renderer.shouldUpdateNoSpeed = True
+                self.library.arducorSetBrightness(renderer.routines, brightness)
+        elif header == idleTimeoutPacketHeader and len(values) == 3:
+            success = True
+            self.idleTimeout = values[2] * 60
+        elif header == customColorCountPacketHeader and len(values) == 3:
+            if values[2] > 1:
+                success = True
+                self.library.arducorSetCustomColorCount(self.writableRenderer().routines, values[2])
+        if success:
+            self.lastMessageTime = time.time()
+        return success
+
+    #-----
+    # Checks a routine change message the same way as the routineParser of the arduino
+    # samples, and applies it if its valid.
+    def parseRoutine(self, values):
+        if len(values) < 3 or values[2] < 0 or values[2] >= routineCount:
+            return False
+        routine = values[2]
+        isSingleRoutine = (routine <= singleSawtoothFadeRoutine)
+        expectedSize = 5
+        maxParam = 0
+        if routine == singleSolidRoutine:
+            expectedSize = 6
+        elif routine in [singleBlinkRoutine, singleWaveRoutine]:
+            expectedSize = 7
+        elif routine in [singleFadeRoutine, singleSawtoothFadeRoutine]:
+            expectedSize = 8
+            maxParam = 1
+        elif routine == singleGlimmerRoutine:
+            expectedSize = 8
+            maxParam = 100
+        elif routine == multiGlimmerRoutine:
+            expectedSize = 6
+            maxParam = 100
+        elif routine == multiBarsRoutine:
+            expectedSize = 6
+            maxParam = 10
+        if len(values) != expectedSize:
+            return False
+
+        speed = 0
+        param = 0
+        palette = paletteCount
+        if isSingleRoutine:
+            for value in values[3:6]:
+                if value < 0 or value > 255:
+                    return False
+            if routine != singleSolidRoutine:
+                speed = values[6]
+            if expectedSize == 8:
+                param = values[7]
+        else:
+            if values[3] < 0 or values[3] >= paletteCount:
+                return False
+            palette = values[3]
+            speed = values[4]
+            if expectedSize == 6:
+                param = values[5]
+        if speed < 0 or speed > maxSpeedValue or param < 0 or param > maxParam:
+            return False
+
+        renderer = self.writableRenderer()
+        resetCounter = (routine != renderer.routine)
+        if isSingleRoutine:
+            if self.library.arducorSetMainColor(renderer.routines, values[3], values[4], values[5]):
+                resetCounter = True
+        elif palette != renderer.palette:
+            resetCounter = True
+            renderer.palette = palette
+        if routine in renderer.params:
+            resetCounter |= (param != renderer.params[routine])
+            renderer.params[routine] = param
+        renderer.routine = routine
+        if routine != singleSolidRoutine:
+            renderer.speed = speed
+        if resetCounter:
+            renderer.resetLoopCounter()
+        return True
+
+    #-----
+    # the values of a state update message that follow the hardware index
+    def stateFields(self):
+        renderer = self.renderer
+        color = (ctypes.c_uint8 * 3)()
+        self.library.arducorColor(renderer.routines, -1, color)
+        return [int(self.library.arducorIsOn(renderer.routines)),
+                1, # isReachable
+                color[0],
+                color[1],
+                color[2],
+                renderer.routine,
+                renderer.palette,
+                self.library.arducorBrightness(renderer.routines),
+                renderer.speed,
+                self.idleTimeout / 60,
+                self.minutesUntilTimeout()]
+
+    #-----
+    # minutes until the device times out, 1 if it never times out and 0 if it already has.
+    def minutesUntilTimeout(self):
+        if self.idleTimeout == 0:
+            return 1
+        elapsed = time.time() - self.lastMessageTime
+        if elapsed > self.idleTimeout:
+            return 0
+        return int((self.idleTimeout - elapsed) / 60) + 1
+
+    #-----
+    # Builds a state update message, without its message delimiter.
+    def stateUpdateMessage(self):
+        values = [stateUpdatePacketHeader, self.hardwareIndex] + self.stateFields()
+        return ",".join(str(value) for value in values)
+
+    #-----
+    # Builds a custom array update message, without its message delimiter.
+    def customArrayUpdateMessage(self):
+        count = self.library.arducorCustomColorCount(self.renderer.routines)
+        values = [customColorUpdatePacketHeader, self.hardwareIndex, count]
+        color = (ctypes.c_uint8 * 3)()
+        for i in range(count):
+            self.library.arducorColor(self.renderer.routines, i, color)
+            values += [color[0], color[1], color[2]]
+        return ",".join(str(value) for value in values)
+
+    #-----
+    # Builds a delta state update message the same way as the arduino samples, holding
+    # only the fields that changed since the client's sequence number.
+    def deltaStateUpdateMessage(self, clientSequence):
+        fields = self.stateFields()
+        changeMask = 0
+        for field in range(stateFieldCount):
+            if clientSequence != self.stateSequence or fields[field] != self.stateSnapshot[field]:
+                changeMask |= (1 << field)
+        values = [deltaStateUpdatePacketHeader, self.hardwareIndex]
+        if changeMask != 0:
+            # the sequence skips 0 when it wraps, so a client can always ask for every field
+            self.stateSequence = self.stateSequence % 255 + 1
+            self.stateSnapshot = fields
+            values += [self.stateSequence, changeMask]
+            values += [fields[field] for field in range(stateFieldCount) if changeMask & (1 << field)]
+        else:
+            values += [self.stateSequence]
+        return ",".join(str(value) for value in values)
+
+    #-----
+    # Runs the routine for each loop the arduino samples would have run since the last
+    # render, and turns the device off once its idle timeout passes.
+    def render(self):
+        now = time.time()
+        self.renderer.render(now)
+        if self.idleTimeout != 0 and self.lastMessageTime + self.idleTimeout < now \
+            and self.library.arducorIsOn(self.renderer.routines):
+            self.library.arducorTurnOff(self.writableRenderer().routines)
+
+    #-----
+    # Builds the frame update messages that change the LEDs from the last frame sent to
+    # the current frame, or that send the whole frame if refresh is True. Whichever of the
+    # changes or the whole frame takes fewer characters is used. Messages are kept to
+    # maxMessageLength characters when they have more than one run.
+    #
+    # Devices that share a RoutineRenderer and were sent the same frame get the same
+    # messages, so they are built once and only the hardware index is changed for the others.
+    def frameMessages(self, refresh, maxMessageLength):
+        renderer = self.renderer
+        frame = renderer.readFrame()
+        sentFrame = self.sentFrame if not refresh else None
+        digits = len(str(self.hardwareIndex))
+        for (cachedSentFrame, length, cachedDigits, hardwareIndex, cached) in renderer.frameMessageCache:
+            if cachedSentFrame is sentFrame and length == maxMessageLength and cachedDigits == digits:
+                start = len("%d,%d," % (frameUpdatePacketHeader, hardwareIndex))
+                self.sentFrame = frame
+                return ["%d,%d,%s" % (frameUpdatePacketHeader, self.hardwareIndex, message[start:])
+                        for message in cached]
+        messages = frameUpdateMessages(self.hardwareIndex, frame, [(0, self.ledCount)], maxMessageLength)
+        if not refresh and self.sentFrame is not None:
+            changedRanges = []
+            for i in range(self.ledCount):
+                if frame[i * 3 : i * 3 + 3] != self.sentFrame[i * 3 : i * 3 + 3]:
+                    if changedRanges and changedRanges[-1][1] == i:
+                        changedRanges[-1] = (changedRanges[-1][0], i + 1)
+                    else:
+                        changedRanges.append((i, i + 1))
+            changes = frameUpdateMessages(self.hardwareIndex, frame, changedRanges, maxMessageLength)
+            if sum(len(message) for message in changes) <= sum(len(message) for message in messages):
+                messages = changes
+        renderer.frameMessageCache.append((sentFrame, maxMessageLength, digits, self.hardwareIndex, messages))
+        self.sentFrame = frame
+        return messages
+
+#-----
+# Lets the devices whose routines look the same share a RoutineRenderer.
+def shareRenderers(devices):
+    leaders = []
+    for device in devices:
+        for leader in leaders:
+            if device.renderer is leader.renderer or device.renderer.looksLike(leader.renderer):
+                device.share(leader)
+                break
+        else:
+            leaders.append(device)
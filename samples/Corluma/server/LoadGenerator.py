@@ -0,0 +1,692 @@
+#!/usr/bin/python
+
+#------------------------------------------------------------
+# LoadGenerator.py
+#------------------------------------------------------------
+# Version 1.1
+# October 17, 2026
+# MIT License (in root of git repo)
+# by Tim Seemann
+#
+#
+# Measures UDPtoSerialAdapter.py under load. It simulates serial devices
+# on ptys and UDP clients on loopback addresses, runs UDPtoSerialAdapter.py
+# on the simulated serial devices, and has the clients send a mix of
+# commands. The time from sending a command over UDP until its echo or
+# reply arrives back at the client is recorded for each command, and a
+# histogram of these times is printed for each kind of command, along with
+# a summary for each lighting device.
+#
+# Each simulated serial device has one lighting device, which is a
+# RenderedDevice from HostRenderer.py, so it parses messages and answers
+# requests the same way as the arduino samples. Its serial port has the
+# timing of an arduino: bytes arrive at serialBaudRate into a receive
+# buffer of serialReceiveBufferSize bytes that is only read between loops,
+# and bytes that arrive while it is full are lost. Like the samples at API
+# level 3.5, it acknowledges packets with a sequence number instead of
+# echoing them. Set apiLevelMinor to 4 to measure serial devices without
+# sequence numbers, and serialErrorRate to measure how lost packets are
+# handled.
+#
+# If a replug interval is given, the last simulated serial device is
+# unplugged that often and plugged back in replugDownTime later, as a new
+# pty at the same path, to measure how the other serial devices are affected.
+#
+# This needs libArduCorRenderer.so, see the README for how to build it,
+# and loopback addresses 127.0.0.2 and up for the clients.
+#
+# Usage: python LoadGenerator.py [clients] [serial devices] [seconds] [replug interval]
+#
+#------------------------------------------------------------
+
+
+#-----
+# imports
+import socket
+import select
+import time
+import sys
+import os
+import errno
+import fcntl
+import pty
+import tty
+import random
+import subprocess
+import tempfile
+import shutil
+import zlib
+import binascii
+from collections import deque
+import HostRenderer
+
+#-----
+# Settings
+
+# port of UDPtoSerialAdapter.py, each client binds it on its own loopback address
+UDP_PORT = 10008
+# baud rate of the simulated serial devices, this must match serialBaudRate of
+# UDPtoSerialAdapter.py.
+serialBaudRate = 9600
+# bytes a simulated arduino holds until it reads them, the size of an arduino's
+# serial receive buffer.
+serialReceiveBufferSize = 64
+# bytes a simulated arduino can write without waiting for them to be sent, the size
+# of an arduino's serial transmit buffer.
+serialTransmitBufferSize = 64
+# seconds between the loops of a simulated arduino, DELAY_VALUE of the samples plus
+# the time to update its LEDs.
+serialLoopTime = 0.012
+# seconds a simulated arduino waits for the rest of a packet once it started reading it.
+serialReadTimeout = 1.0
+# max packet size and checksums that the simulated serial devices advertise, the
+# same as the NeoPixels sample.
+maxPacketSize = 200
+supportedChecksums = 7
+# API level minor version that the simulated serial devices advertise. Sequence numbers
+# are supported from 5 on.
+apiLevelMinor = 5
+# chance that a character sent to a simulated serial device is corrupted on its way,
+# so that its packet fails its checksum.
+serialErrorRate = 0.0
+# number of LEDs of each simulated lighting device
+ledCount = 64
+# commands each client sends a second
+clientCommandRate = 5.0
+# how often each kind of command is sent, relative to the others. Sliders change the
+# brightness or a custom color, routines change the routine, and the polls request a
+# state update, custom array update or delta state update.
+commandMix = [("slider", 6), ("color", 2), ("routine", 1), ("onOff", 1),
+              ("statePoll", 1), ("customPoll", 1), ("deltaPoll", 1)]
+# seconds a command can wait for its echo or reply before it counts as unanswered.
+# Messages that are overwritten by a newer one for the same setting before they are
+# sent are never echoed, and requests that UDPtoSerialAdapter.py polled for itself are
+# answered to itself, so some unanswered commands are expected.
+commandTimeout = 2.0
+# seconds an unplugged simulated serial device stays unplugged
+replugDownTime = 1.0
+# upper bounds, in milliseconds, of the buckets of the latency histograms
+histogramBuckets = [5, 10, 20, 50, 100, 200, 500, 1000, 2000]
+
+# Checksum types, the same as UDPtoSerialAdapter.py
+checksumNone = 0
+checksumCRC32 = 1
+checksumCRC16 = 2
+checksumFletcher16 = 4
+# Header value of the message that gives a packet a sequence number, the same as
+# UDPtoSerialAdapter.py
+sequenceNumberPacketHeader = 10
+
+# mode change messages that a routine command picks from, without their hardware index
+routineMessages = ["0,255,0,0",
+                   "0,0,0,255",
+                   "3,0,255,0,100,10",
+                   "4,255,255,255,80,1",
+                   "7,1,120",
+                   "9,6,200",
+                   "10,13,60,4"]
+
+#--------------------------------
+# Checksum Functions
+#--------------------------------
+
+#-----
+# Computes the checksum of a message the same way as UDPtoSerialAdapter.py.
+def checksumCalculator(message, checksumType):
+    if checksumType == checksumCRC16:
+        return binascii.crc_hqx(message, 0xFFFF)
+    elif checksumType == checksumFletcher16:
+        sum1 = 0
+        sum2 = 0
+        for data in bytearray(message):
+            sum1 += data
+            sum2 += sum1
+        return ((sum2 % 255) << 8) | (sum1 % 255)
+    return zlib.crc32(message) & 0xFFFFFFFF
+
+#-----
+# appends a checksum to a packet, if a checksum is used
+def appendChecksum(packet, checksumType):
+    if checksumType != checksumNone:
+        packet += "#" + str(checksumCalculator(packet, checksumType)) + "&"
+    return packet
+
+#-----
+# Splits the checksum from a packet. Returns the packet without its checksum, and True
+# if the checksum matched.
+def checkChecksum(packet, checksumType):
+    if checksumType == checksumNone:
+        return packet, packet.find("#") == -1
+    split = packet.split("#")
+    if len(split) != 2:
+        return packet, False
+    return split[0], split[1].rstrip()[:-1] == str(checksumCalculator(split[0], checksumType))
+
+#--------------------------------
+# Simulated Serial Devices
+#--------------------------------
+
+#-----
+# A serial device on a pty, with a single lighting device. UDPtoSerialAdapter.py is
+# given a symlink to the pty, so the serial device can be unplugged and plugged back
+# in at the same path.
+class SimulatedSerialDevice:
+
+    #-----
+    def __init__(self, library, hardwareIndex, directory):
+        self.library = library
+        self.hardwareIndex = hardwareIndex
+        self.path = os.path.join(directory, "serial" + str(hardwareIndex))
+        self.master = None
+        self.droppedBytes = 0
+        self.receivedPackets = 0
+        self.invalidPackets = 0
+        self.replugCount = 0
+        self.plug()
+
+    #-----
+    # Creates a new pty and points the path at it. Like an arduino that was just plugged
+    # in, the serial device starts from its default state.
+    def plug(self):
+        self.master, self.slave = pty.openpty()
+        tty.setraw(self.slave)
+        flags = fcntl.fcntl(self.master, fcntl.F_GETFL)
+        fcntl.fcntl(self.master, fcntl.F_SETFL, flags | os.O_NONBLOCK)
+        os.symlink(os.ttyname(self.slave), self.path)
+        self.device = HostRenderer.RenderedDevice(self.library, self.hardwareIndex, ledCount)
+        self.checksumType = checksumCRC32
+        # characters on their way to the arduino, with the time each one arrives
+        self.wire = deque()
+        self.lastArrivalTime = 0
+        # characters in the receive buffer
+        self.receiveBuffer = ""
+        # characters of the packet being read, or None if the arduino isn't reading one
+        self.packet = None
+        self.readStartTime = 0
+        # time the arduino next checks its serial port
+        self.readTime = time.time()
+        # packets the arduino is sending, with the time each one finishes arriving
+        self.replies = deque()
+
+    #-----
+    # Closes the pty and removes the path, the same as unplugging a USB cable.
+    def unplug(self):
+        os.remove(self.path)
+        os.close(self.master)
+        os.close(self.slave)
+        self.master = None
+        self.replugCount += 1
+
+    #-----
+    # seconds it takes to send a number of bytes, at 10 bits per byte.
+    def sendTime(self, byteCount):
+        return byteCount * 10.0 / serialBaudRate
+
+    #-----
+    # Reads the characters written to the pty. Each character arrives one character's
+    # send time after the one before it.
+    def readPort(self):
+        while True:
+            try:
+                characters = os.read(self.master, 4096)
+            except OSError as error:
+                if error.errno in [errno.EAGAIN, errno.EWOULDBLOCK]:
+                    return
+                raise
+            if not characters:
+                return
+            now = time.time()
+            for character in characters:
+                if random.random() < serialErrorRate:
+                    character = chr(random.randint(32, 126))
+                self.lastArrivalTime = max(self.lastArrivalTime + self.sendTime(1), now)
+                self.wire.append((self.lastArrivalTime, character))
+
+    #-----
+    # Checks the serial port at each loop until the given time. The arduino starts
+    # reading once a check finds characters in its receive buffer.
+    def checkSerialPort(self, untilTime):
+        while self.packet is None and self.readTime <= untilTime:
+            if self.receiveBuffer:
+                self.packet = self.receiveBuffer
+                self.receiveBuffer = ""
+                self.readStartTime = self.readTime
+            else:
+                self.readTime += serialLoopTime
+
+    #-----
+    # Moves the characters that have arrived into the packet being read or the receive
+    # buffer, handles a packet once it has been read, and writes the replies that have
+    # been sent.
+    def update(self):
+        if self.master is None:
+            return
+        self.readPort()
+        now = time.time()
+        while self.wire and self.wire[0][0] <= now:
+            arrivalTime, character = self.wire.popleft()
+            self.checkSerialPort(arrivalTime)
+            if self.packet is not None:
+                self.packet += character
+            elif len(self.receiveBuffer) < serialReceiveBufferSize:
+                self.receiveBuffer += character
+            else:
+                self.droppedBytes += 1
+        self.checkSerialPort(now)
+        if self.packet is not None:
+            # the arduino reads until a ';' or until it has read its max packet size, and
+            # the characters after the packet stay in the receive buffer
+            end = self.packet.find(";", 0, maxPacketSize)
+            if end != -1 or len(self.packet) >= maxPacketSize:
+                if end == -1:
+                    packet = self.packet[:maxPacketSize]
+                    self.receiveBuffer = self.packet[maxPacketSize:][:serialReceiveBufferSize]
+                else:
+                    packet = self.packet[:end]
+                    self.receiveBuffer = self.packet[end + 1:][:serialReceiveBufferSize]
+                self.packet = None
+                self.handlePacket(packet, now)
+            elif now - self.readStartTime > serialReadTimeout:
+                self.packet = None
+                self.invalidPackets += 1
+                self.readTime = now + serialLoopTime
+        while self.replies and self.replies[0][0] <= now:
+            os.write(self.master, self.replies.popleft()[1])
+
+    #-----
+    # the time of the next event of this serial device, or None if it is idle.
+    def nextEventTime(self):
+        if self.master is None:
+            return None
+        times = []
+        if self.wire:
+            times.append(self.wire[0][0])
+        if self.receiveBuffer or self.packet is not None:
+            times.append(self.readTime)
+        if self.replies:
+            times.append(self.replies[0][0])
+        if times:
+            return min(times)
+        return None
+
+    #-----
+    # Sends packets the same way as the arduino: the loop waits until all but the
+    # transmit buffer has been sent, then it updates its LEDs and sleeps before it
+    # checks the serial port again.
+    def sendPackets(self, packets, now):
+        sendStart = now
+        for packet in packets:
+            sendStart = max(sendStart, self.replies[-1][0] if self.replies else now)
+            self.replies.append((sendStart + self.sendTime(len(packet)), packet))
+        if self.replies:
+            blockedUntil = self.replies[-1][0] - self.sendTime(serialTransmitBufferSize)
+        else:
+            blockedUntil = now
+        self.readTime = max(now, blockedUntil) + serialLoopTime
+
+    #-----
+    # Handles a packet the same way as the arduino samples: discovery packets and
+    # checksum selections are answered with the discovery packet, requests are answered
+    # with updates, and the last valid message of any other packet is echoed. A packet
+    # with a sequence number is acknowledged after its replies instead of echoed.
+    def handlePacket(self, packet, now):
+        self.receivedPackets += 1
+        packet = packet.strip()
+        if packet.startswith("DISCOVERY_PACKET"):
+            values = packet.split(",")
+            if len(values) == 2 and values[1].isdigit() and int(values[1]) & supportedChecksums:
+                self.checksumType = int(values[1])
+            elif len(values) != 1:
+                return self.sendPackets([], now)
+            return self.sendPackets([self.discoveryPacket()], now)
+        payload, passedChecksum = checkChecksum(packet, self.checksumType)
+        if not passedChecksum:
+            self.invalidPackets += 1
+            return self.sendPackets([], now)
+        replies = []
+        echo = None
+        skipEcho = False
+        sequenceNumber = None
+        appliedMessages = 0
+        for index, message in enumerate([message for message in payload.split("&") if message]):
+            values = message.split(",")
+            if values[0] == str(sequenceNumberPacketHeader) and apiLevelMinor >= 5:
+                if len(values) == 2 and values[1].isdigit():
+                    sequenceNumber = int(values[1])
+            elif values[0] == str(HostRenderer.stateUpdatePacketHeader):
+                replies.append(self.device.stateUpdateMessage())
+                skipEcho = True
+            elif values[0] == str(HostRenderer.customColorUpdatePacketHeader):
+                replies.append(self.device.customArrayUpdateMessage())
+                skipEcho = True
+            elif values[0] == str(HostRenderer.deltaStateUpdatePacketHeader):
+                if len(values) == 3 and values[2].isdigit():
+                    replies.append(self.device.deltaStateUpdateMessage(int(values[2])))
+                skipEcho = True
+            elif values[0] == str(HostRenderer.frameUpdatePacketHeader):
+                skipEcho = True
+            elif len(values) > 1 and values[1] in ["0", str(self.hardwareIndex)]:
+                if self.device.parseMessage(values):
+                    echo = message
+                    if index < 32:
+                        appliedMessages |= 1 << index
+        if sequenceNumber is not None:
+            replies.append("%d,%d,%d" % (sequenceNumberPacketHeader, sequenceNumber, appliedMessages))
+        elif echo is not None and not skipEcho:
+            replies.append(echo)
+        self.sendPackets([appendChecksum(reply + "&", self.checksumType) + ";" for reply in replies], now)
+
+    #-----
+    # the discovery packet of the serial device, which never uses a checksum.
+    def discoveryPacket(self):
+        return "DISCOVERY_PACKET,3," + str(apiLevelMinor) + "," + str(supportedChecksums) + ",0," + str(maxPacketSize) \
+            + ",1@Simulated " + str(self.hardwareIndex) + ",0,0&;"
+
+#--------------------------------
+# Simulated UDP Clients
+#--------------------------------
+
+#-----
+# A UDP client on its own loopback address that sends commands to random lighting
+# devices and records how long each takes to be answered.
+class SimulatedClient:
+
+    #-----
+    def __init__(self, clientIndex, hardwareIndices, results):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind(("127.0.0." + str(clientIndex + 2), UDP_PORT))
+        self.sock.setblocking(0)
+        self.hardwareIndices = hardwareIndices
+        self.results = results
+        # commands waiting for their echo, message -> (kind, send time)
+        self.pendingEchoes = {}
+        # requests waiting for their reply, header -> deque of (kind, send time)
+        self.pendingReplies = {}
+        self.nextSendTime = time.time() + random.random() / clientCommandRate
+
+    #-----
+    # sends a packet with a single message to UDPtoSerialAdapter.py
+    def send(self, message):
+        self.sock.sendto(appendChecksum(message + "&", checksumCRC32), ("127.0.0.1", UDP_PORT))
+
+    #-----
+    # Picks a command from commandMix. Returns its kind, the hardware index it is for,
+    # its message, and the start of the reply that answers it, or None if its echo
+    # answers it. State and custom array requests are for every lighting device, so
+    # their hardware index is 0.
+    def nextCommand(self):
+        pick = random.uniform(0, sum(weight for (kind, weight) in commandMix))
+        for (kind, weight) in commandMix:
+            pick -= weight
+            if pick <= 0:
+                break
+        hardwareIndex = random.choice(self.hardwareIndices)
+        if kind == "slider":
+            message = "3,%d,%d" % (hardwareIndex, random.randint(0, 100))
+        elif kind == "color":
+            message = "2,%d,%d,%d,%d,%d" % (hardwareIndex, random.randint(0, 9), random.randint(0, 255),
+                                            random.randint(0, 255), random.randint(0, 255))
+        elif kind == "routine":
+            message = "1,%d,%s" % (hardwareIndex, random.choice(routineMessages))
+        elif kind == "onOff":
+            message = "0,%d,%d" % (hardwareIndex, random.randint(0, 1))
+        elif kind == "statePoll":
+            header = str(HostRenderer.stateUpdatePacketHeader)
+            return kind, 0, header, header
+        elif kind == "customPoll":
+            header = str(HostRenderer.customColorUpdatePacketHeader)
+            return kind, 0, header, header
+        else:
+            header = "%d,%d" % (HostRenderer.deltaStateUpdatePacketHeader, hardwareIndex)
+            return kind, hardwareIndex, header + ",0", header
+        return kind, hardwareIndex, message, None
+
+    #-----
+    # Sends the next command once it is time to.
+    def update(self, now):
+        if now < self.nextSendTime:
+            return
+        self.nextSendTime += 1.0 / clientCommandRate
+        kind, hardwareIndex, message, replyStart = self.nextCommand()
+        self.results.sent(kind, hardwareIndex)
+        if replyStart is not None:
+            self.pendingReplies.setdefault(replyStart, deque()).append((kind, hardwareIndex, now))
+        elif message not in self.pendingEchoes:
+            self.pendingEchoes[message] = (kind, hardwareIndex, now)
+        self.send(message)
+
+    #-----
+    # Reads the packets sent to this client and records the commands they answer.
+    def receive(self):
+        while True:
+            try:
+                packet = self.sock.recv(1024)
+            except socket.error as error:
+                if error.errno in [errno.EAGAIN, errno.EWOULDBLOCK]:
+                    return
+                raise
+            now = time.time()
+            payload, passedChecksum = checkChecksum(packet, checksumCRC32)
+            if not passedChecksum:
+                continue
+            for message in payload.split("&"):
+                if message in self.pendingEchoes:
+                    kind, hardwareIndex, sendTime = self.pendingEchoes.pop(message)
+                    self.results.answered(kind, hardwareIndex, now - sendTime)
+                    continue
+                # requests waiting in the same queue are answered by a single reply,
+                # so a reply answers every request for it. Delta state updates are
+                # matched by their hardware index as well.
+                values = message.split(",")
+                for replyStart in [values[0], ",".join(values[0:2])]:
+                    while self.pendingReplies.get(replyStart):
+                        kind, hardwareIndex, sendTime = self.pendingReplies[replyStart].popleft()
+                        self.results.answered(kind, hardwareIndex, now - sendTime)
+
+    #-----
+    # Forgets the commands that have waited longer than commandTimeout, so they stay
+    # unanswered.
+    def expireCommands(self, now):
+        for message, (kind, hardwareIndex, sendTime) in self.pendingEchoes.items():
+            if now - sendTime > commandTimeout:
+                del self.pendingEchoes[message]
+        for replies in self.pendingReplies.values():
+            while replies and now - replies[0][2] > commandTimeout:
+                replies.popleft()
+
+#--------------------------------
+# Results
+#--------------------------------
+
+#-----
+# The number of commands sent and the latencies of the answered ones, for each kind of
+# command and for each hardware index.
+class Results:
+
+    #-----
+    def __init__(self):
+        self.sentCounts = {}
+        self.latencies = {}
+        self.deviceSentCounts = {}
+        self.deviceLatencies = {}
+
+    #-----
+    def sent(self, kind, hardwareIndex):
+        self.sentCounts[kind] = self.sentCounts.get(kind, 0) + 1
+        self.deviceSentCounts[hardwareIndex] = self.deviceSentCounts.get(hardwareIndex, 0) + 1
+
+    #-----
+    def answered(self, kind, hardwareIndex, latency):
+        self.latencies.setdefault(kind, []).append(latency * 1000.0)
+        self.deviceLatencies.setdefault(hardwareIndex, []).append(latency * 1000.0)
+
+    #-----
+    # Prints the answered share, percentiles and a histogram of the latencies of each
+    # kind of command, then the commands answered a second over the given seconds.
+    def printResults(self, seconds):
+        for (kind, weight) in commandMix:
+            sentCount = self.sentCounts.get(kind, 0)
+            if sentCount == 0:
+                continue
+            latencies = sorted(self.latencies.get(kind, []))
+            print "%-10s sent %6d  answered %6d (%5.1f%%)" % (kind, sentCount, len(latencies),
+                                                               100.0 * len(latencies) / sentCount),
+            if not latencies:
+                print
+                continue
+            percentile = lambda p: latencies[min(len(latencies) - 1, int(p * len(latencies)))]
+            print " p50 %7.1f ms  p90 %7.1f ms  p99 %7.1f ms  max %7.1f ms" % (
+                percentile(0.5), percentile(0.9), percentile(0.99), latencies[-1])
+            counts = [0] * (len(histogramBuckets) + 1)
+            for latency in latencies:
+                bucket = 0
+                while bucket < len(histogramBuckets) and latency >= histogramBuckets[bucket]:
+                    bucket += 1
+                counts[bucket] += 1
+            for bucket, count in enumerate(counts):
+                if bucket < len(histogramBuckets):
+                    label = "< %d ms" % histogramBuckets[bucket]
+                else:
+                    label = ">= %d ms" % histogramBuckets[-1]
+                bar = "#" * int(round(40.0 * count / len(latencies)))
+                print "    %10s |%-40s| %d" % (label, bar, count)
+        for hardwareIndex in sorted(self.deviceSentCounts.keys()):
+            sentCount = self.deviceSentCounts[hardwareIndex]
+            latencies = sorted(self.deviceLatencies.get(hardwareIndex, []))
+            if hardwareIndex == 0:
+                label = "all lights"
+            else:
+                label = "light " + str(hardwareIndex)
+            print "%-10s sent %6d  answered %6d (%5.1f%%)" % (label, sentCount, len(latencies),
+                                                               100.0 * len(latencies) / sentCount),
+            if latencies:
+                print " p50 %7.1f ms  p99 %7.1f ms" % (latencies[len(latencies) / 2],
+                                                      latencies[min(len(latencies) - 1, int(0.99 * len(latencies)))])
+            else:
+                print
+        answeredCount = sum(len(latencies) for latencies in self.latencies.values())
+        print "%d of %d commands answered, %.1f a second" % (answeredCount, sum(self.sentCounts.values()),
+                                                            answeredCount / seconds)
+
+#--------------------------------
+# Main
+#--------------------------------
+
+clientCount = int(sys.argv[1]) if len(sys.argv) > 1 else 1
+serialDeviceCount = int(sys.argv[2]) if len(sys.argv) > 2 else 1
+duration = float(sys.argv[3]) if len(sys.argv) > 3 else 10.0
+replugInterval = float(sys.argv[4]) if len(sys.argv) > 4 else 0.0
+
+library = HostRenderer.loadLibrary()
+# the paths of the simulated serial devices
+serialDirectory = tempfile.mkdtemp(prefix="LoadGenerator")
+serialDevices = [SimulatedSerialDevice(library, x + 1, serialDirectory) for x in range(serialDeviceCount)]
+# time the last serial device is next unplugged or plugged back in
+replugTime = None
+results = Results()
+clients = [SimulatedClient(x, range(1, serialDeviceCount + 1), results) for x in range(clientCount)]
+
+print "Starting UDPtoSerialAdapter.py with " + str(serialDeviceCount) + " simulated serial devices..."
+adapterPath = os.path.join(os.path.dirname(os.path.abspath(__file__)), "UDPtoSerialAdapter.py")
+adapter = subprocess.Popen([sys.executable, "-u", adapterPath] + [device.path for device in serialDevices],
+                           stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+flags = fcntl.fcntl(adapter.stdout, fcntl.F_GETFL)
+fcntl.fcntl(adapter.stdout, fcntl.F_SETFL, flags | os.O_NONBLOCK)
+adapterOutput = ""
+
+#-----
+# Services the simulated serial devices, the clients and the output of
+# UDPtoSerialAdapter.py until the given time, or until stopCondition returns True.
+# Clients only send commands if sendCommands is True, and the last serial device
+# is only replugged while they do.
+def run(untilTime, sendCommands, stopCondition=None):
+    global adapterOutput
+    global replugTime
+    while time.time() < untilTime:
+        if stopCondition is not None and stopCondition():
+            return
+        if adapter.poll() is not None:
+            print adapterOutput
+            print "UDPtoSerialAdapter.py stopped."
+            sys.exit(1)
+        now = time.time()
+        timeout = untilTime - now
+        for device in serialDevices:
+            eventTime = device.nextEventTime()
+            if eventTime is not None:
+                timeout = min(timeout, eventTime - now)
+        if sendCommands:
+            for client in clients:
+                timeout = min(timeout, client.nextSendTime - now)
+            if replugTime is not None:
+                timeout = min(timeout, replugTime - now)
+        readable, writable, exceptional = select.select([device.master for device in serialDevices
+                                                         if device.master is not None]
+                                                        + [client.sock for client in clients]
+                                                        + [adapter.stdout],
+                                                        [], [], max(0.0, timeout))
+        if adapter.stdout in readable:
+            try:
+                adapterOutput += os.read(adapter.stdout.fileno(), 4096)
+            except OSError:
+                pass
+        for device in serialDevices:
+            device.update()
+        now = time.time()
+        if sendCommands and replugTime is not None and now >= replugTime:
+            if serialDevices[-1].master is None:
+                serialDevices[-1].plug()
+                replugTime = now + replugInterval
+            else:
+                serialDevices[-1].unplug()
+                replugTime = now + replugDownTime
+        for client in clients:
+            client.receive()
+            if sendCommands:
+                client.update(now)
+            client.expireCommands(now)
+
+try:
+    # discovery, then the first UDP packet starts the main loop of UDPtoSerialAdapter.py
+    run(time.time() + 30.0, False, lambda: "Setup the UDP Socket" in adapterOutput)
+    # "Setup the UDP Socket" is printed before the socket is bound, so this is sent until it arrives
+    startTime = time.time()
+    while time.time() - startTime < 5.0 and "Starting main loop" not in adapterOutput:
+        clients[0].send(str(HostRenderer.stateUpdatePacketHeader))
+        run(time.time() + 0.1, False, lambda: "Starting main loop" in adapterOutput)
+    if "Starting main loop" not in adapterOutput:
+        print adapterOutput
+        print "UDPtoSerialAdapter.py didn't start."
+        sys.exit(1)
+    # every client sends a request first, so it is subscribed to every lighting device
+    for client in clients:
+        client.send(str(HostRenderer.stateUpdatePacketHeader))
+    run(time.time() + 1.0, False)
+    for client in clients:
+        client.pendingEchoes.clear()
+        client.pendingReplies.clear()
+        client.nextSendTime = time.time() + random.random() / clientCommandRate
+
+    print "Sending commands from " + str(clientCount) + " clients for " + str(duration) + " seconds..."
+    mainLoopOutput = len(adapterOutput)
+    if replugInterval > 0:
+        replugTime = time.time() + replugInterval
+    run(time.time() + duration, True)
+    # wait for the answers to the last commands
+    run(time.time() + commandTimeout, False)
+    for client in clients:
+        client.expireCommands(time.time() + commandTimeout + 1.0)
+finally:
+    if adapter.poll() is None:
+        adapter.terminate()
+        adapter.wait()
+    shutil.rmtree(serialDirectory)
+
+results.printResults(duration)
+for device in serialDevices:
+    print "Serial device " + str(device.hardwareIndex) + ": " + str(device.receivedPackets) + " packets, " \
+        + str(device.invalidPackets) + " invalid, " + str(device.droppedBytes) + " bytes lost to a full receive buffer, " \
+        + str(device.replugCount) + " times replugged"
+# anything UDPtoSerialAdapter.py printed during the run, such as serial devices it rediscovered
+print adapterOutput[mainLoopOutput:].strip()
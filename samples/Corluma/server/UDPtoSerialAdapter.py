@@ -3,8 +3,8 @@
 #------------------------------------------------------------
 # UDPtoSerial.py
 #------------------------------------------------------------
-# Version 2.8
-# May 27, 2018
+# Version 3.3
+# October 17, 2026
 # MIT License (in root of git repo)
 # by Tim Seemann
 #
@@ -14,23 +14,139 @@
 # over serial. It also takes serial packets and echoes
 # them over UDP.
 #
+# The UDP socket and all serial ports are serviced from a single select loop.
+# Each serial device has its own bounded write queue, so a slow device can't
+# stall the others. Messages that change a state replace any pending message
+# they overwrite, and pending messages are only sent as fast as the serial
+# link can carry them and the arduino can read them. State update and custom
+# array update requests are answered from a cache of each serial device's last
+# updates when possible.
+#
+# Serial devices with an API level of 3.5 or later are sent packets with a
+# sequence number, which they acknowledge with the messages they applied. Each
+# applied message is echoed to the UDP clients, and the messages of a packet that
+# is never acknowledged are sent again.
+#
+# Packets from the serial devices are sent to every UDP client subscribed to
+# the lighting devices they are from. A UDP client is subscribed to the lighting
+# devices it sends messages to, or to all of them by sending requests, until it
+# hasn't sent anything for clientLeaseTime.
+#
+# If renderOnHost is True, the lighting routines are run by this script
+# using HostRenderer.py, and the arduinos are only sent the frames to show.
+# Lighting devices that are sent the same messages share their routine, so it
+# is rendered once for all of them until one of them is changed on its own.
+#
+# Serial devices can be unplugged and plugged back in while the script runs.
+# A serial device that fails a read or write, or whose path goes away or leads
+# to a different device, is closed and its lighting devices are removed. Once
+# its path exists again, it is reopened and discovered in the background while
+# the other serial devices keep running.
+#
 #------------------------------------------------------------
 
 
 #-----
 # imports
 import socket
+import select
 import time
 import serial
 import sys
-from ctypes import c_uint32
-from numpy import bitwise_xor, right_shift
+import os
+import errno
+import fcntl
+from collections import deque, OrderedDict
+import HostRenderer
+import zlib
+import binascii
 
 # Change this port if it conflicts with another program on your system
 UDP_PORT = 10008
 # Header values for packets for state updates and custom color updates
 stateUpdatePacketHeader = 6
 customColorUpdatePacketHeader = 7
+# Header values for messages that change a state
+onOffPacketHeader = 0
+brightnessPacketHeader = 3
+# Header values for messages that set a routine or a custom color, their third
+# value picks which routine or custom color they set.
+modeChangePacketHeader = 1
+customArrayColorPacketHeader = 2
+# messages with headers up to this one change a state, so a later message can overwrite them.
+lastStateChangePacketHeader = 5
+# Header value of the message that gives a packet a sequence number. It is only sent to
+# serial devices with an API level minor version of at least sequenceNumberMinorAPILevel.
+sequenceNumberPacketHeader = 10
+sequenceNumberMinorAPILevel = 5
+# Checksum types, these are bit flags so that a discovery packet can advertise
+# more than one type in its CRC field.
+checksumNone = 0
+checksumCRC32 = 1
+checksumCRC16 = 2
+checksumFletcher16 = 4
+# checksums supported by this script, ordered from cheapest to most expensive.
+checksumPreference = [checksumFletcher16, checksumCRC16, checksumCRC32]
+# Stages each serial device goes through during discovery.
+discoveryStageSearching = 0
+discoveryStageChecksum = 1
+discoveryStageHardwareIndices = 2
+discoveryStageDone = 3
+discoveryStageDisconnected = 4
+# seconds to wait for a reply during discovery before asking again
+discoveryRetryInterval = 0.1
+# seconds between checks for serial devices that were unplugged or plugged back in.
+serialDeviceCheckInterval = 1.0
+# packets waiting to be written to a single serial device. Once full, the oldest
+# packet is dropped.
+maxWriteQueueSize = 8
+# bytes kept from a serial device that hasn't sent a ";" yet.
+maxReadBufferSize = 1024
+# baud rate of the serial devices. Pending messages are sent no faster than
+# this rate can carry them, at 10 bits per byte.
+serialBaudRate = 9600
+# bytes an arduino holds until its sketch reads them, the size of its serial receive
+# buffer. Bytes that arrive once it is full are lost.
+serialReceiveBufferSize = 64
+# seconds an arduino can spend between reads of its serial port, its loop delay plus
+# the time it takes to update its LEDs.
+serialLoopTime = 0.015
+# seconds to wait for the replies to a request before sending the next packet anyway,
+# in case the request or its replies failed their checksum. A packet with a sequence
+# number that isn't acknowledged in this time is lost, and its messages are sent again.
+serialReplyTimeout = 1.0
+# packets with a sequence number that can wait for their acknowledgement at once.
+maxUnacknowledgedPackets = 4
+# messages in a packet with a sequence number, including the sequence number. The
+# acknowledgement holds a bit for each message and the arduino samples only have bits for
+# the first 32 messages, so this can't be more than 32.
+maxSequencedMessages = 32
+# seconds a UDP client stays subscribed to lighting devices after its last packet.
+clientLeaseTime = 30.0
+# seconds between the checks for UDP clients whose lease ended.
+clientLeaseCheckInterval = 1.0
+# seconds between the requests that refresh the cached updates of each serial device.
+cachePollInterval = 2.0
+# seconds after a message that changes a state is sent before the cached updates
+# are used again. This gives the arduino time to apply the change and echo it.
+writeSettleTime = 0.5
+# Set to True to run the lighting routines on this computer and send each arduino the
+# frames to show, instead of having the arduinos run them. This needs libArduCorRenderer.so,
+# see the README for how to build it.
+renderOnHost = False
+# number of LEDs of each lighting device, this must match LED_COUNT / DEVICE_COUNT of the
+# arduino sketch.
+renderLEDCount = 64
+# frames per second sent to each serial device, at most. Fewer are sent if a frame
+# takes longer than this to send at the serial baud rate.
+renderFramesPerSecond = 30
+# bytes the renderer may keep in all, for all lighting devices, of the frames of the routines
+# that repeat, so that each frame is only computed once. 0 turns the frame cache off.
+renderFrameCacheSize = 64 * 1024 * 1024
+# seconds between frames that send every LED instead of only the changed ones, so a
+# frame lost to a bad checksum is repaired and the arduinos don't reach their own idle
+# timeout while the frame doesn't change.
+frameRefreshInterval = 30.0
 
 #--------------------------------
 # Message Parsing Functions
@@ -38,22 +154,46 @@ customColorUpdatePacketHeader = 7
 
 #-----
 # takes a list of messages, appends them to a single string with message delimiters,
-# computes the CRC for this string, appends that, and then returns the full message packet
+# computes the CRC for this string, appends that, and then returns the full message packet.
+# The messages are expected to fit in a single packet, see fitsInPacket.
 def convertMessageListToPacket(messageList, serialIndex):
     packet = ""
     if checkIfDiscoveryPacket(messageList[0]):
         packet += messageList[0]
     else:
-        for message in messageList:
-            # leave room for a CRC and metadata, so only append if we're not exceeding
-            # max packet size
-            if (len(packet) + len(message) < maxPacketSizeList[serialIndex] - 16):
-                packet += message
-                packet += "&"
-        packet = appendCRC(packet)
+        packet = appendCRC("&".join(messageList) + "&", checksumTypeList[serialIndex])
     packet += ";"
     return packet
 
+#-----
+# largest packet that a serial device is sent. If the arduino's receive buffer fills up
+# faster than its loop reads it, a packet that arrives while the arduino sleeps is only
+# safe if it fits in the receive buffer.
+def maxSerialPacketSize(serialIndex):
+    if serialSendTime(serialReceiveBufferSize) < serialLoopTime:
+        return min(maxPacketSizeList[serialIndex], serialReceiveBufferSize)
+    return maxPacketSizeList[serialIndex]
+
+#-----
+# True if a message can be added to a packet for a serial device that already holds
+# packetLength characters of messages, leaving room for a CRC and metadata, and for
+# a sequence number if the device supports them. The first message of a packet only
+# has to fit in the arduino's max packet size, so a message that is longer than
+# maxSerialPacketSize is still sent, on its own.
+def fitsInPacket(serialIndex, packetLength, message, sequenced=False):
+    reserved = 0
+    if sequenced:
+        # the sequence number is the first message of the packet
+        reserved = len(sequenceNumberMessage(255)) + 1
+    if packetLength == 0:
+        return reserved + len(message) + 1 < maxPacketSizeList[serialIndex] - 16
+    return reserved + packetLength + len(message) + 1 < maxSerialPacketSize(serialIndex) - 16
+
+#-----
+# the message that gives a packet its sequence number
+def sequenceNumberMessage(sequenceNumber):
+    return str(sequenceNumberPacketHeader) + "," + str(sequenceNumber)
+
 #-----
 # a really ugly function that parses a packet as individual messages, and then
 # sorts them into a message dictionary where the key is the serial device's index.
@@ -68,35 +208,102 @@ def sortMessages(packet):
             if len(values) > 0:
                 if values[0] != '':
                     if (int(values[0]) in [stateUpdatePacketHeader,customColorUpdatePacketHeader]):
-                        multiCastMessage(message)
-                    if len(values) > 1:
+                        requestUpdate(message, int(values[0]))
+                    elif int(values[0]) == sequenceNumberPacketHeader:
+                        # sequence numbers are picked by this script for each serial device
+                        continue
+                    elif len(values) > 1:
                         hardwareIndex = int(values[1])
                         if (hardwareIndex == 0):
                             multiCastMessage(message)
                         else:
                             # find serial index by using hardware index
                             index = findSerialIndexForHardwareIndex(hardwareIndex)
-                            messageDict[index].append(message)
+                            if index != -1:
+                                addPendingMessage(index, message)
 
 #-----
-# helper to convert a hardware index to a serial index
+# helper to convert a hardware index to a serial index, -1 if no serial device has it
 def findSerialIndexForHardwareIndex(hardwareIndex):
-    serialIndex = 0
-    retIndex = -1
-    for serialDevices in lightHardwareIndices:
-        for lightIndex in serialDevices:
-            if lightIndex == hardwareIndex:
-                retIndex = serialIndex
-        serialIndex = serialIndex + 1
-    return retIndex
+    return serialIndexForHardwareIndex.get(hardwareIndex, -1)
 
 #-----
-# Takes a message and puts it in every serial devices message dictionary
+# Takes a message and puts it in every serial devices pending messages
 def multiCastMessage(message):
-    index = 0
-    for devices in lightHardwareIndices:
-        messageDict[index].append(message)
-        index = index + 1
+    for x in range(0, numOfSerialDevices):
+        if isDiscovered(x):
+            addPendingMessage(x, message)
+
+#-----
+# the key used to find the pending messages that a message overwrites, or None
+# if the message doesn't change a state. The key holds the header, the number of
+# values, the hardware index, and for mode changes and custom array colors, the
+# routine or color index.
+def coalescingKey(values):
+    if len(values) < 3 or not values[0].isdigit() \
+        or int(values[0]) > lastStateChangePacketHeader:
+        return None
+    if int(values[0]) in [modeChangePacketHeader, customArrayColorPacketHeader]:
+        return (values[0], len(values), values[1], values[2])
+    return (values[0], len(values), values[1], None)
+
+#-----
+# True if a message with newKey overwrites a pending message with pendingKey. This
+# matches the arduino samples: a hardware index of 0 overwrites every index.
+def overwritesMessage(newKey, pendingKey):
+    return pendingKey is not None \
+        and newKey[0] == pendingKey[0] \
+        and newKey[1] == pendingKey[1] \
+        and (newKey[2] == pendingKey[2] or newKey[2] == "0") \
+        and newKey[3] == pendingKey[3]
+
+#-----
+# Adds a message to a serial device's pending messages. Any pending message that it
+# overwrites is removed, so only the newest state is sent. Messages that don't change
+# a state, such as requests, are kept unless the same message is already pending, since
+# its reply is sent to every subscribed client.
+def addPendingMessage(serialIndex, message):
+    global pendingMessageCounter
+    global coalescedMessageCount
+    if renderOnHost:
+        renderMessage(serialIndex, message)
+        return
+    key = coalescingKey(message.split(","))
+    if key is not None:
+        for pendingKey in pendingMessageList[serialIndex].keys():
+            if overwritesMessage(key, pendingMessageList[serialIndex][pendingKey][0]):
+                del pendingMessageList[serialIndex][pendingKey]
+                coalescedMessageCount = coalescedMessageCount + 1
+    elif (None, message) in pendingMessageList[serialIndex].values():
+        coalescedMessageCount = coalescedMessageCount + 1
+        return
+    pendingMessageCounter = pendingMessageCounter + 1
+    pendingMessageList[serialIndex][pendingMessageCounter] = (key, message)
+
+#-----
+# removes and returns the oldest pending messages of a serial device that fit in a single
+# packet. A message too long for the arduino to read is dropped.
+def takePendingMessages(serialIndex):
+    global oversizedMessageCount
+    messageList = []
+    packetLength = 0
+    sequenced = sequenceSupportList[serialIndex]
+    for pendingKey, (key, message) in pendingMessageList[serialIndex].items():
+        if sequenced and len(messageList) == maxSequencedMessages - 1:
+            break
+        if not fitsInPacket(serialIndex, packetLength, message, sequenced):
+            if packetLength > 0:
+                break
+            del pendingMessageList[serialIndex][pendingKey]
+            oversizedMessageCount = oversizedMessageCount + 1
+            continue
+        messageList.append(message)
+        packetLength += len(message) + 1
+        del pendingMessageList[serialIndex][pendingKey]
+        if key is not None:
+            lastWriteTimes[serialIndex] = time.time()
+            unechoedWrites[serialIndex] += 1
+    return messageList
 
 #-----
 # takes a message and, if theres more than one serial device and theres a 0
@@ -111,7 +318,7 @@ def convertMultiCastPackets(message, serialIndex):
         headerIndex = values[0]
         # send the message as is if its a state update or custom color update
         if not(headerIndex == str(stateUpdatePacket) or headerIndex == str (customColorUpdatePacketHeader)):
-            return [message]
+            return [appendCRC(message, udpChecksumType())]
     if (len(values) > 1):
         headerIndex = values[0]
         hardwareIndex = values[1]
@@ -131,16 +338,18 @@ def convertMultiCastPackets(message, serialIndex):
 # Takes a message that contains a CRC, splits it and stores the given CRC,
 # then it computes a new CRC and checks if they are the same. If they are the
 # same, this function return true, otherwise, it returns false.
-def checkCRC(message):
+def checkCRC(message, checksumType):
     # check for packet with no &
     ampCheckList = message.split("&")
-    if (len(ampCheckList) != 1):
+    if (checksumType == checksumNone):
+        return message, (len(ampCheckList) != 1 and message.find("#") == -1)
+    elif (len(ampCheckList) != 1):
         crcSplitArray = message.split("#")
         if len(crcSplitArray) == 2:
             payload = crcSplitArray[0]
             givenCRC = crcSplitArray[1].rstrip()[:-1]
             #print "Given: " + givenCRC
-            computedCRC = crcCalculator(payload)
+            computedCRC = checksumCalculator(payload, checksumType)
             #print "Computed: " + str(computedCRC)
             if str(computedCRC) == givenCRC:
                 return payload, True
@@ -155,16 +364,8 @@ def checkCRC(message):
 # create a packet based on an array of integers. This automatically adds a
 # CRC but it does not add a ";"
 def createPacket(valueArray):
-    packet = ""
-    # generate the packet again
-    for value in valueArray:
-        packet += str(value)
-        packet += ","
-    # remove the last comma
-    packet = packet[:-1]
-    packet += "&"
-    packet = appendCRC(packet)
-    return packet
+    packet = ",".join(str(value) for value in valueArray) + "&"
+    return appendCRC(packet, udpChecksumType())
 
 #--------------------------------
 # Discovery Functions
@@ -187,23 +388,27 @@ def buildDiscoveryPacket():
     discoveryPacket += str(useCRC) + ","
     discoveryPacket += str(1) + "," # hardware capabilities flag, 1 for raspberry pi
     discoveryPacket += str(maxPacketSizeServer) + ","
-    discoveryPacket += str(deviceCount) + "@"
-    for i in range(deviceCount):
-        discoveryPacket += nameList[i]
+    # names are stored per serial device, flatten them in serial device order
+    names = [name for serialNames in nameList for name in serialNames]
+    types = [lightType for serialTypes in typeList for lightType in serialTypes]
+    products = [product for serialProducts in productList for product in serialProducts]
+    discoveryPacket += str(len(names)) + "@"
+    for i in range(len(names)):
+        discoveryPacket += names[i]
         discoveryPacket += ","
-        discoveryPacket += typeList[i]
+        discoveryPacket += types[i]
         discoveryPacket += ","
-        discoveryPacket += productList[i]
-        if (i != deviceCount - 1):
+        discoveryPacket += products[i]
+        if (i != len(names) - 1):
             discoveryPacket += ","
     discoveryPacket += "&"
     return discoveryPacket
 
 #-----
 # append a CRC packet with the correct delimiters based on a packet
-def appendCRC(packet):
-    if useCRC:
-        crc = crcCalculator(packet)
+def appendCRC(packet, checksumType):
+    if checksumType != checksumNone:
+        crc = checksumCalculator(packet, checksumType)
         packet += "#"
         packet += str(crc)
         packet += "&"
@@ -211,9 +416,11 @@ def appendCRC(packet):
 
 #-----
 # This parses a discovery packet, and, if its valid, sets global variables
-# that are used during creating packets and checking packet validity
+# that are used during creating packets and checking packet validity. Names, types
+# and products are stored per serial device since devices can reply in any order.
 def parseDiscoveryPacket(packet, serialIndex):
     global useCRC
+    global checksumTypeList
     global deviceCount
     global maxPacketSizeList
     global majorAPILevel
@@ -230,7 +437,7 @@ def parseDiscoveryPacket(packet, serialIndex):
         try:
             majorAPILevel = int(discoverySplitArray[1])
             minorAPILevel = int(discoverySplitArray[2])
-            useCRC = int(discoverySplitArray[3])
+            checksumTypes = int(discoverySplitArray[3])
             hardwareCapabilities = int(discoverySplitArray[4])
             maxPacketSize = int(discoverySplitArray[5])
             count = int(discoverySplitArray[6])
@@ -238,20 +445,27 @@ def parseDiscoveryPacket(packet, serialIndex):
             for x in range(count * 3):
                 if packetIndex == 0:
                     deviceCount = deviceCount + 1
-                    nameList.append(nameSplitArray[x])
+                    nameList[serialIndex].append(nameSplitArray[x])
                     packetIndex = 1
                 elif packetIndex == 1:
-                    typeList.append(nameSplitArray[x])
+                    typeList[serialIndex].append(nameSplitArray[x])
                     packetIndex = 2
                 elif packetIndex == 2:
-                    productList.append(nameSplitArray[x])
+                    productList[serialIndex].append(nameSplitArray[x])
                     packetIndex = 0
 
-            if (useCRC == 1 or useCRC == 0) \
+            if (checksumTypes >= 0 and checksumTypes <= 7) \
                 and majorAPILevel == 3 \
-                and deviceCount < 20 \
+                and count < 20 \
                 and maxPacketSize < 500:
                 maxPacketSizeList[serialIndex] = maxPacketSize
+                checksumTypeList[serialIndex] = chooseChecksumType(checksumTypes)
+                sequenceSupportList[serialIndex] = minorAPILevel >= sequenceNumberMinorAPILevel
+                # the UDP side always uses CRC-32 if the serial devices use checksums.
+                if checksumTypes != checksumNone:
+                    useCRC = 1
+                else:
+                    useCRC = 0
                 return True
         except ValueError:
             pass
@@ -259,92 +473,580 @@ def parseDiscoveryPacket(packet, serialIndex):
 
 
 #-----
-# Read serial streams looking only for a discovery packet. Return false if anything
-# else is returned, return true if and only if a parseable discovery packet is found.
-def readForDiscovery(serialPort, serialIndex):
-    message = readSerialPort(serialPort)
+# Checks a serial packet for a discovery packet. Return false if anything else
+# is given, return true if and only if a parseable discovery packet is found.
+def readForDiscovery(message, serialIndex):
     if len(message) >= 16:
         subString = message[0:16]
         if checkIfDiscoveryPacket(subString):
             return parseDiscoveryPacket(message, serialIndex)
     return False
 
+#-----
+# picks the cheapest checksum supported by both the script and a serial device.
+# devices that don't advertise a checksum don't use one.
+def chooseChecksumType(checksumTypes):
+    for checksumType in checksumPreference:
+        if checksumTypes & checksumType:
+            return checksumType
+    return checksumNone
+
+#-----
+# Builds a packet that asks a serial device to switch to a new checksum type.
+def checksumSelectionPacket(checksumType):
+    return "DISCOVERY_PACKET," + str(checksumType) + ";"
+
+#-----
+# Checks a serial packet for the discovery packet sent as a reply to a checksum selection.
+# The device only replies if it switched to the requested checksum.
+def readForChecksumSelection(message):
+    return checkIfDiscoveryPacket(message[0:16])
+
+#-----
+# the checksum used for packets sent to and received from UDP clients.
+def udpChecksumType():
+    if useCRC:
+        return checksumCRC32
+    return checksumNone
+
 #-----
 # looks through a state update packet received during discovery and determines
 # the hardware indices associated with the serial device. These are then added
 # into the lightHardwareIndices list
-def parseStateUpdateForHardwareIndices(serialPort, serialIndex):
+def parseStateUpdateForHardwareIndices(packet, serialIndex):
     global lightHardwareIndices
-    packet = readSerialPort(serialPort)
     if len(packet) >= 5:
-        packet = packet.rstrip()[:-1]
-        packet, passedCRC = checkCRC(packet)
+        packet, passedCRC = checkCRC(packet, checksumTypeList[serialIndex])
         if passedCRC:
             # break up the packet into multiple messages
             messageArray = packet.split("&")
             # only if a packet is considered is valid, parse it
             if len(messageArray) > 0:
-                messageisValid = False
+                messageIsValid = False
                 for message in messageArray:
                     # split each message by its delimiter
                     values = message.split(",")
                     if len(values) == 13:
                         if values[0] == str(stateUpdatePacketHeader):
                             lightHardwareIndices[serialIndex].append(int(values[1]))
+                            stateUpdateCache[serialIndex][int(values[1])] = message
                             messageIsValid = True
                 return messageIsValid
     return False
 
 #-----
 # Builds a packet to request state updates
-def stateUpdatePacket():
+def stateUpdatePacket(serialIndex):
     packet = str(stateUpdatePacketHeader)
     packet += "&"
-    packet = appendCRC(packet)
+    packet = appendCRC(packet, checksumTypeList[serialIndex])
     packet += ";"
     return packet
 
+#-----
+# Queues the request for the discovery stage that a serial device is currently in.
+def sendDiscoveryRequest(serialIndex):
+    stage = discoveryStageList[serialIndex]
+    if stage == discoveryStageSearching:
+        queueSerialPacket(serialIndex, "DISCOVERY_PACKET;")
+    elif stage == discoveryStageChecksum:
+        # ask the device to use the cheapest checksum both sides support
+        queueSerialPacket(serialIndex, checksumSelectionPacket(checksumTypeList[serialIndex]))
+        checksumSelectionAttempts[serialIndex] = checksumSelectionAttempts[serialIndex] + 1
+    elif stage == discoveryStageHardwareIndices:
+        # ask for state updates to find the hardware indices on the serial device
+        queueSerialPacket(serialIndex, stateUpdatePacket(serialIndex))
+    discoveryRequestTimes[serialIndex] = time.time()
+
+#-----
+# Moves a serial device to the next discovery stage if the packet it sent is
+# the reply that stage is waiting for. The next request is sent right away.
+def handleDiscoveryReply(serialIndex, packet):
+    stage = discoveryStageList[serialIndex]
+    if stage == discoveryStageSearching:
+        if readForDiscovery(packet, serialIndex):
+            # devices always start with CRC-32 or no checksum, so only ask for a switch if needed.
+            if checksumTypeList[serialIndex] in [checksumNone, checksumCRC32]:
+                discoveryStageList[serialIndex] = discoveryStageHardwareIndices
+            else:
+                discoveryStageList[serialIndex] = discoveryStageChecksum
+    elif stage == discoveryStageChecksum:
+        if readForChecksumSelection(packet):
+            discoveryStageList[serialIndex] = discoveryStageHardwareIndices
+    elif stage == discoveryStageHardwareIndices:
+        if parseStateUpdateForHardwareIndices(packet, serialIndex):
+            discoveryStageList[serialIndex] = discoveryStageDone
+            print "Serial Device #" + str(serialIndex) + " found with lighting devices " + str(lightHardwareIndices[serialIndex])
+    if discoveryStageList[serialIndex] != stage \
+        and discoveryStageList[serialIndex] != discoveryStageDone:
+        sendDiscoveryRequest(serialIndex)
+
+#-----
+# Resends discovery requests to any serial device that hasn't replied recently.
+def retryDiscoveryRequests():
+    now = time.time()
+    for x in range(0, numOfSerialDevices):
+        if isDiscovering(x) \
+            and now - discoveryRequestTimes[x] >= discoveryRetryInterval:
+            if discoveryStageList[x] == discoveryStageChecksum \
+                and checksumSelectionAttempts[x] >= maxChecksumSelectionAttempts:
+                # the device never confirmed the switch, so fall back to CRC-32
+                checksumTypeList[x] = checksumCRC32
+                discoveryStageList[x] = discoveryStageHardwareIndices
+            sendDiscoveryRequest(x)
+
+#--------------------------------
+# Hot-Plug Functions
+#--------------------------------
+
+#-----
+# True if a serial device finished discovery, so it can be sent messages.
+def isDiscovered(serialIndex):
+    return discoveryStageList[serialIndex] == discoveryStageDone
+
+#-----
+# True if a serial device is open but hasn't finished discovery.
+def isDiscovering(serialIndex):
+    return discoveryStageList[serialIndex] not in [discoveryStageDone, discoveryStageDisconnected]
+
+#-----
+# Maps each hardware index to the serial device it is on, and rebuilds the discovery
+# packet. The map is replaced in one step after a serial device is discovered or
+# disconnected, so messages are never routed with a partial map.
+def mapHardwareIndices():
+    global serialIndexForHardwareIndex
+    global deviceCount
+    global discoveryPacket
+    maxIndex = -1
+    hardwareIndexMap = {}
+    for serialIndex, serialDeviceNumbers in enumerate(lightHardwareIndices):
+        for lightIndex in serialDeviceNumbers:
+            hardwareIndexMap[lightIndex] = serialIndex
+            if lightIndex > maxIndex:
+                maxIndex = lightIndex
+    serialIndexForHardwareIndex = hardwareIndexMap
+    deviceCount = maxIndex
+    discoveryPacket = buildDiscoveryPacket()
+
+#-----
+# Opens a serial port without blocking reads or writes. Returns None if it can't be opened.
+def openSerialPort(path):
+    try:
+        # a timeout of 0 makes serial.read nonblocking
+        serialPort = serial.Serial(path, serialBaudRate, timeout=0.0)
+    except (serial.serialutil.SerialException, OSError):
+        return None
+    # writes go straight to the file descriptor, so make sure they can't block either
+    flags = fcntl.fcntl(serialPort.fileno(), fcntl.F_GETFL)
+    fcntl.fcntl(serialPort.fileno(), fcntl.F_SETFL, flags | os.O_NONBLOCK)
+    return serialPort
+
+#-----
+# the serial ports that are open
+def connectedSerialPorts():
+    return [serialPort for serialPort in serialDevices if serialPort is not None]
+
+#-----
+# Forgets everything learned from a serial device, so it starts over as if the script
+# just started.
+def resetSerialDevice(serialIndex):
+    lightHardwareIndices[serialIndex] = []
+    nameList[serialIndex] = []
+    typeList[serialIndex] = []
+    productList[serialIndex] = []
+    checksumTypeList[serialIndex] = checksumCRC32
+    checksumSelectionAttempts[serialIndex] = 0
+    pendingMessageList[serialIndex].clear()
+    linkFreeTimes[serialIndex] = 0
+    serialReadTimes[serialIndex] = 0
+    awaitedReplies[serialIndex] = 0
+    replyDeadlines[serialIndex] = 0
+    sequenceSupportList[serialIndex] = False
+    nextSequenceNumbers[serialIndex] = 0
+    unacknowledgedPackets[serialIndex].clear()
+    stateUpdateCache[serialIndex] = {}
+    customArrayUpdateCache[serialIndex] = {}
+    cacheUpdateTimes[serialIndex] = {stateUpdatePacketHeader: 0, customColorUpdatePacketHeader: 0}
+    lastWriteTimes[serialIndex] = 0
+    unechoedWrites[serialIndex] = 0
+    lastPollTimes[serialIndex] = 0
+    unansweredPolls[serialIndex] = {stateUpdatePacketHeader: 0, customColorUpdatePacketHeader: 0}
+    writeQueueList[serialIndex].clear()
+    pendingWriteList[serialIndex] = ''
+    readBufferList[serialIndex] = ''
+    for device in renderedDevices[serialIndex]:
+        device.release()
+    renderedDevices[serialIndex] = []
+    frameMessageList[serialIndex].clear()
+    lastFrameTimes[serialIndex] = 0
+    lastRefreshTimes[serialIndex] = 0
+
+#-----
+# Closes a serial device that was unplugged or failed a read or write. Its lighting
+# devices are removed until it is plugged back in and discovered again.
+def disconnectSerialDevice(serialIndex):
+    if serialDevices[serialIndex] is None:
+        return
+    try:
+        serialDevices[serialIndex].close()
+    except (serial.serialutil.SerialException, OSError):
+        pass
+    serialDevices[serialIndex] = None
+    discoveryStageList[serialIndex] = discoveryStageDisconnected
+    resetSerialDevice(serialIndex)
+    mapHardwareIndices()
+    print "Serial Device #" + str(serialIndex) + " disconnected."
+
+#-----
+# Reopens a serial device that was disconnected and starts discovering it again.
+def reconnectSerialDevice(serialIndex):
+    serialPort = openSerialPort(serialPaths[serialIndex])
+    if serialPort is None:
+        return
+    serialDevices[serialIndex] = serialPort
+    resetSerialDevice(serialIndex)
+    discoveryStageList[serialIndex] = discoveryStageSearching
+    sendDiscoveryRequest(serialIndex)
+
+#-----
+# True if the path of an open serial device no longer leads to it, because it was
+# unplugged or another device now has its path.
+def serialPathChanged(serialIndex):
+    try:
+        return os.stat(serialPaths[serialIndex]).st_rdev \
+            != os.fstat(serialDevices[serialIndex].fileno()).st_rdev
+    except OSError:
+        return True
+
+#-----
+# Every serialDeviceCheckInterval, disconnects serial devices whose path changed and
+# reconnects disconnected serial devices whose path exists again.
+def checkSerialDevices():
+    global nextSerialDeviceCheckTime
+    now = time.time()
+    if now < nextSerialDeviceCheckTime:
+        return
+    nextSerialDeviceCheckTime = now + serialDeviceCheckInterval
+    for x in range(0, numOfSerialDevices):
+        if serialDevices[x] is not None and serialPathChanged(x):
+            disconnectSerialDevice(x)
+        if serialDevices[x] is None and os.path.exists(serialPaths[x]):
+            reconnectSerialDevice(x)
+
+#-----
+# Reads the replies of a serial device that is being discovered again. Once it is
+# discovered, its lighting devices are added to the map of hardware indices.
+def readDiscoveryReplies(serialIndex):
+    for packet in readSerialPackets(serialIndex):
+        handleDiscoveryReply(serialIndex, packet)
+        if isDiscovered(serialIndex):
+            if renderOnHost:
+                createRenderedDevices(serialIndex)
+            mapHardwareIndices()
+            return
+
+#-----
+# seconds until the next serial device check or discovery retry.
+def secondsUntilNextSerialDeviceCheck():
+    now = time.time()
+    timeout = max(0.0, nextSerialDeviceCheckTime - now)
+    for x in range(0, numOfSerialDevices):
+        if isDiscovering(x):
+            timeout = min(timeout, max(0.0, discoveryRequestTimes[x] + discoveryRetryInterval - now))
+    return timeout
+
+#--------------------------------
+# State Cache Functions
+#--------------------------------
+
+#-----
+# Takes a state update or custom array update request and answers it from the
+# cache of every serial device that can. The request is sent to the rest.
+def requestUpdate(message, header):
+    global lastUpdateRequestTime
+    if renderOnHost:
+        for x in range(0, numOfSerialDevices):
+            if isDiscovered(x):
+                answerRequestFromRenderer(x, header)
+        return
+    lastUpdateRequestTime = time.time()
+    for x in range(0, numOfSerialDevices):
+        if isDiscovered(x) and not answerRequestFromCache(x, header):
+            addPendingMessage(x, message)
+
+#-----
+# True if the cache of a serial device matches its state. Every message that changes
+# a state must have been sent and echoed back, or had writeSettleTime to do so.
+def cacheIsSettled(serialIndex):
+    for (key, message) in pendingMessageList[serialIndex].values():
+        if key is not None:
+            return False
+    return unechoedWrites[serialIndex] == 0 \
+        or time.time() - lastWriteTimes[serialIndex] >= writeSettleTime
+
+#-----
+# True if a cache has an update for every lighting device on a serial device, and the
+# updates were refreshed recently enough to include changes the arduino makes on its
+# own, like idle timeouts.
+def cacheIsFresh(serialIndex, header):
+    if header == stateUpdatePacketHeader:
+        cache = stateUpdateCache[serialIndex]
+    else:
+        cache = customArrayUpdateCache[serialIndex]
+    for hardwareIndex in lightHardwareIndices[serialIndex]:
+        if hardwareIndex not in cache:
+            return False
+    return time.time() - cacheUpdateTimes[serialIndex][header] <= cachePollInterval + writeSettleTime
+
+#-----
+# Sends a serial device's cached state update or custom array update to the UDP client
+# that requested it, the same way as if the serial device had sent it. Returns False if
+# the cache can't be used.
+def answerRequestFromCache(serialIndex, header):
+    if not cacheIsFresh(serialIndex, header) or not cacheIsSettled(serialIndex):
+        return False
+    if header == stateUpdatePacketHeader:
+        # a serial device sends the states of all its lighting devices in one packet
+        packet = ""
+        for hardwareIndex in lightHardwareIndices[serialIndex]:
+            packet += stateUpdateCache[serialIndex][hardwareIndex] + "&"
+        sendSerialPacketOverUDP(serialIndex, packet, [addr[0]])
+    else:
+        for hardwareIndex in lightHardwareIndices[serialIndex]:
+            sendSerialPacketOverUDP(serialIndex, customArrayUpdateCache[serialIndex][hardwareIndex] + "&", [addr[0]])
+    return True
+
+#-----
+# Updates the cache of a serial device from a packet it sent. State updates and custom
+# array updates are stored and echoes of messages that change a state are applied, so
+# the cache follows the arduino in the same order it makes changes.
+# Returns True if the packet was a reply to a poll from this script.
+def updateCache(serialIndex, packet):
+    header = None
+    for message in packet.split("&"):
+        values = message.split(",")
+        if len(values) == 13 and values[0] == str(stateUpdatePacketHeader):
+            stateUpdateCache[serialIndex][int(values[1])] = message
+            header = stateUpdatePacketHeader
+        elif len(values) > 3 and values[0] == str(customColorUpdatePacketHeader):
+            customArrayUpdateCache[serialIndex][int(values[1])] = message
+            header = customColorUpdatePacketHeader
+        elif coalescingKey(values) is not None:
+            applyEchoToCache(serialIndex, values)
+            if unechoedWrites[serialIndex] > 0:
+                unechoedWrites[serialIndex] -= 1
+    if header is None:
+        return False
+    cacheUpdateTimes[serialIndex][header] = time.time()
+    if unansweredPolls[serialIndex][header] > 0:
+        unansweredPolls[serialIndex][header] -= 1
+        return True
+    return False
+
+#-----
+# Applies an echoed message to the cached updates of the lighting devices it was sent to.
+# On/off, brightness and custom array color changes are applied the same way the arduino
+# samples apply them, other messages clear the cache since they change too many values.
+def applyEchoToCache(serialIndex, values):
+    header = int(values[0])
+    hardwareIndex = int(values[1])
+    value = int(values[2])
+    for cachedIndex in lightHardwareIndices[serialIndex]:
+        if hardwareIndex != 0 and hardwareIndex != cachedIndex:
+            continue
+        if header in [onOffPacketHeader, brightnessPacketHeader] and len(values) == 3:
+            if cachedIndex in stateUpdateCache[serialIndex]:
+                state = stateUpdateCache[serialIndex][cachedIndex].split(",")
+                if header == brightnessPacketHeader:
+                    state[9] = str(min(max(value, 0), 100))
+                elif value in [0, 1]:
+                    state[2] = str(value)
+                stateUpdateCache[serialIndex][cachedIndex] = ",".join(state)
+        elif header == customArrayColorPacketHeader and len(values) == 6:
+            if cachedIndex in customArrayUpdateCache[serialIndex]:
+                customArray = customArrayUpdateCache[serialIndex][cachedIndex].split(",")
+                # only colors up to the custom color count are in the update
+                if value >= 0 and value < int(customArray[2]):
+                    customArray[3 + value * 3 : 6 + value * 3] = values[3:6]
+                    customArrayUpdateCache[serialIndex][cachedIndex] = ",".join(customArray)
+        else:
+            stateUpdateCache[serialIndex].clear()
+            customArrayUpdateCache[serialIndex].clear()
+            return
+
+#-----
+# Queues state update and custom array update requests for serial devices so that their
+# cache is refreshed every cachePollInterval. Devices are only polled while UDP clients are
+# asking for updates, so the polls don't keep an arduino from reaching its idle timeout,
+# and only when they have no pending messages, so polls never delay messages from UDP clients.
+def pollSerialDevices():
+    now = time.time()
+    if now - lastUpdateRequestTime > cachePollInterval:
+        return
+    for x in range(0, numOfSerialDevices):
+        if not isDiscovered(x) or len(pendingMessageList[x]) or not cacheIsSettled(x):
+            continue
+        isFresh = cacheIsFresh(x, stateUpdatePacketHeader) \
+            and cacheIsFresh(x, customColorUpdatePacketHeader)
+        if now - lastPollTimes[x] >= cachePollInterval \
+            or (not isFresh and now - lastPollTimes[x] >= writeSettleTime):
+            lastPollTimes[x] = now
+            # a serial device with more than one lighting device sends a custom
+            # array update for each of them
+            unansweredPolls[x][stateUpdatePacketHeader] = 1
+            unansweredPolls[x][customColorUpdatePacketHeader] = len(lightHardwareIndices[x])
+            addPendingMessage(x, str(stateUpdatePacketHeader))
+            addPendingMessage(x, str(customColorUpdatePacketHeader))
+
+#--------------------------------
+# Host Rendering Functions
+#--------------------------------
+
+#-----
+# Creates the rendered devices of a serial device once it is discovered. They continue
+# from the state the arduino had during discovery.
+def createRenderedDevices(serialIndex):
+    for hardwareIndex in lightHardwareIndices[serialIndex]:
+        renderedDevices[serialIndex].append(HostRenderer.RenderedDevice(renderLibrary,
+                                                                        hardwareIndex,
+                                                                        renderLEDCount,
+                                                                        stateUpdateCache[serialIndex][hardwareIndex].split(",")))
+    shareRenderedDevices()
+
+#-----
+# Lets the rendered devices of every serial device that look the same share their routine.
+def shareRenderedDevices():
+    HostRenderer.shareRenderers([device for devices in renderedDevices for device in devices])
+
+#-----
+# Applies a message to the rendered devices of a serial device that it is meant for, and
+# echoes it over UDP if it is valid, the same as the arduino would. Delta state update
+# requests are answered instead, to the UDP client that sent them.
+def renderMessage(serialIndex, message):
+    values = message.split(",")
+    if len(values) < 2 or not values[1].isdigit():
+        return
+    hardwareIndex = int(values[1])
+    devices = [device for device in renderedDevices[serialIndex]
+               if hardwareIndex == 0 or hardwareIndex == device.hardwareIndex]
+    if values[0] == str(HostRenderer.deltaStateUpdatePacketHeader):
+        if len(values) == 3 and values[2].isdigit():
+            packet = ""
+            for device in devices:
+                packet += device.deltaStateUpdateMessage(int(values[2])) + "&"
+            if packet:
+                sendSerialPacketOverUDP(serialIndex, packet, [addr[0]])
+        return
+    # every device is given the message, even after one finds it invalid
+    results = [device.parseMessage(values) for device in devices]
+    if hardwareIndex == 0:
+        shareRenderedDevices()
+    if any(results):
+        sendSerialPacketOverUDP(serialIndex, message + "&")
+
+#-----
+# Answers a state update or custom array update request with the state of the rendered
+# devices of a serial device, the same way as the arduino would. The answer only goes to
+# the UDP client that requested it.
+def answerRequestFromRenderer(serialIndex, header):
+    if header == stateUpdatePacketHeader:
+        packet = ""
+        for device in renderedDevices[serialIndex]:
+            packet += device.stateUpdateMessage() + "&"
+        sendSerialPacketOverUDP(serialIndex, packet, [addr[0]])
+    else:
+        for device in renderedDevices[serialIndex]:
+            sendSerialPacketOverUDP(serialIndex, device.customArrayUpdateMessage() + "&", [addr[0]])
+
+#-----
+# Renders the next frame of each rendered device of a serial device, and queues the
+# frame update messages that show it. A frame is only rendered once the previous frame
+# has been sent and renderFramesPerSecond allows it.
+def renderFrame(serialIndex):
+    global sentFrameCount
+    now = time.time()
+    if now - lastFrameTimes[serialIndex] < 1.0 / renderFramesPerSecond:
+        return
+    lastFrameTimes[serialIndex] = now
+    refresh = (now - lastRefreshTimes[serialIndex] >= frameRefreshInterval)
+    if refresh:
+        lastRefreshTimes[serialIndex] = now
+    frameMessages = []
+    for device in renderedDevices[serialIndex]:
+        device.render()
+        # a message that fits in a serial packet on its own, see fitsInPacket
+        frameMessages += device.frameMessages(refresh, maxSerialPacketSize(serialIndex) - 18)
+    if frameMessages:
+        sentFrameCount = sentFrameCount + 1
+        frameMessageList[serialIndex].extend(frameMessages)
+
+#-----
+# removes and returns the queued frame update messages of a serial device that fit in a single packet.
+def takeFrameMessages(serialIndex):
+    global oversizedMessageCount
+    messageList = []
+    packetLength = 0
+    while frameMessageList[serialIndex]:
+        message = frameMessageList[serialIndex][0]
+        if not fitsInPacket(serialIndex, packetLength, message):
+            if packetLength > 0:
+                break
+            frameMessageList[serialIndex].popleft()
+            oversizedMessageCount = oversizedMessageCount + 1
+            continue
+        messageList.append(frameMessageList[serialIndex].popleft())
+        packetLength += len(message) + 1
+    return messageList
+
+#-----
+# seconds until the next serial device can be sent a frame.
+def secondsUntilNextFrame():
+    timeout = None
+    now = time.time()
+    for x in range(0, numOfSerialDevices):
+        if not isDiscovered(x):
+            continue
+        frameTime = lastFrameTimes[x] + 1.0 / renderFramesPerSecond
+        wait = max(0.0, nextWriteTime(x) - now, frameTime - now)
+        if timeout is None or wait < timeout:
+            timeout = wait
+    return timeout
+
 #--------------------------------
 # CRC Functions
 #--------------------------------
 
-# lookup table to speed up the long divsion of a CRC
-crcTable = [
-    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
-    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
-    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
-    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
-    ]
-
-#-----
-# uses the lookup table to compute the changes to the CRC
-def crcUpdate(crc, data):
-    tableIndex = 0
-    tableIndex = bitwise_xor(crc,
-                             c_uint32((data >> (0 * 4))))
-    crc = bitwise_xor(c_uint32(crcTable[tableIndex & 0x0f]),
-                      c_uint32((right_shift(crc, c_uint32(4)))))
-    tableIndex = bitwise_xor(crc,
-                             c_uint32((data >> (1 * 4))))
-    crc = bitwise_xor(c_uint32(crcTable[tableIndex & 0x0f]),
-                      c_uint32((right_shift(crc, c_uint32(4)))))
-    return crc
-
-#-----
-# Takes a message, loops through its characters, and computes a CRC that can
-# represent that message
+#-----
+# Computes a CRC-32 of a message. zlib uses the same polynomial, initial value and final
+# inversion as the arduino samples, and computes it in C.
 def crcCalculator(message):
-    crc = c_uint32(~0L)
-    #print "input: " + input
-    for c in message:
-        crc = crcUpdate(crc, ord(c))
-        #print "CRC: " + str(crc)
-    try:
-        crc = long(~crc)
-    except:
-        crc = long(0)
-    #print "final crc: " + str(crc)
-    return crc
+    return zlib.crc32(message) & 0xFFFFFFFF
+
+#-----
+# Computes a CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) of a message.
+# binascii computes the same CRC in C.
+def crc16Calculator(message):
+    return binascii.crc_hqx(message, 0xFFFF)
+
+#-----
+# Computes a Fletcher-16 checksum of a message. Taking the modulo of each sum once at
+# the end gives the same result as taking it after every character.
+def fletcher16Calculator(message):
+    sum1 = 0
+    sum2 = 0
+    for data in bytearray(message):
+        sum1 += data
+        sum2 += sum1
+    return ((sum2 % 255) << 8) | (sum1 % 255)
+
+#-----
+# Computes the checksum of a message using the given checksum type
+def checksumCalculator(message, checksumType):
+    if checksumType == checksumCRC16:
+        return crc16Calculator(message)
+    elif checksumType == checksumFletcher16:
+        return fletcher16Calculator(message)
+    return crcCalculator(message)
 
 
 #--------------------------------
@@ -352,37 +1054,286 @@ def crcCalculator(message):
 #--------------------------------
 
 #-----
-# take messages from the message dictionary, turn them into proper
-# serial messages, then send them to the serial device
+# seconds it takes to send a number of bytes over a serial link, at 10 bits per byte.
+def serialSendTime(byteCount):
+    return byteCount * 10.0 / serialBaudRate
+
+#-----
+# the number of reply packets an arduino sends for a packet of messages. Requests are
+# answered with a state update, a delta state update, or a custom array update for each
+# of its lighting devices. Echoes of other messages aren't counted, since they fit in the
+# arduino's transmit buffer and don't hold up its loop.
+def expectedReplies(serialIndex, messageList):
+    replies = 0
+    for message in messageList:
+        header = message.split(",")[0]
+        if header == str(customColorUpdatePacketHeader):
+            replies += len(lightHardwareIndices[serialIndex])
+        elif header in [str(stateUpdatePacketHeader), str(HostRenderer.deltaStateUpdatePacketHeader)]:
+            replies += 1
+    return replies
+
+#-----
+# the time a serial device can be sent its next packet. The arduino reads a packet while
+# it arrives, then replies and spends up to serialLoopTime before reading again, so its
+# next read is expected serialLoopTime after it received the packet, or after it sent the
+# last reply to a request. Bytes that arrive before then wait in its receive buffer, so
+# the next packet can start as many bytes early as the receive buffer holds. Once
+# maxUnacknowledgedPackets are waiting for their acknowledgement, the next packet waits
+# for the oldest one to be acknowledged or lost.
+def nextWriteTime(serialIndex):
+    if awaitedReplies[serialIndex] > 0:
+        readTime = replyDeadlines[serialIndex]
+    else:
+        readTime = serialReadTimes[serialIndex]
+    writeTime = max(linkFreeTimes[serialIndex], readTime - serialSendTime(serialReceiveBufferSize))
+    if len(unacknowledgedPackets[serialIndex]) >= maxUnacknowledgedPackets:
+        writeTime = max(writeTime, unacknowledgedPackets[serialIndex].values()[0][1])
+    return writeTime
+
+#-----
+# queues a packet of messages for a serial device and records when the device is expected
+# to read its next packet.
+def writeSerialPacket(serialIndex, messageList):
+    now = time.time()
+    packet = convertMessageListToPacket(messageList, serialIndex)
+    queueSerialPacket(serialIndex, packet)
+    linkFreeTimes[serialIndex] = now + serialSendTime(len(packet))
+    serialReadTimes[serialIndex] = linkFreeTimes[serialIndex] + serialLoopTime
+    awaitedReplies[serialIndex] = expectedReplies(serialIndex, messageList)
+    replyDeadlines[serialIndex] = linkFreeTimes[serialIndex] + serialReplyTimeout
+
+#-----
+# queues a packet of messages for a serial device with the next sequence number, and
+# keeps its messages until the packet is acknowledged.
+def writeSequencedPacket(serialIndex, messageList):
+    sequenceNumber = nextSequenceNumbers[serialIndex]
+    nextSequenceNumbers[serialIndex] = (sequenceNumber + 1) % 256
+    writeSerialPacket(serialIndex, [sequenceNumberMessage(sequenceNumber)] + messageList)
+    unacknowledgedPackets[serialIndex][sequenceNumber] = (messageList, replyDeadlines[serialIndex])
+
+#-----
+# Handles the acknowledgement of a packet with a sequence number. It holds a bit for
+# each message of the packet that the arduino applied, starting with the sequence number
+# in bit 0. Applied messages that change a state are echoed to the UDP clients and
+# applied to the cache, the same way as an echo from an arduino without sequence numbers.
+# Packets sent before the acknowledged one that are still unacknowledged were lost.
+def acknowledgePacket(serialIndex, packet):
+    values = packet.split("&")[0].split(",")
+    try:
+        sequenceNumber = int(values[1])
+        appliedMessages = int(values[2])
+    except (IndexError, ValueError):
+        return
+    if sequenceNumber not in unacknowledgedPackets[serialIndex]:
+        # a packet that was already given up as lost
+        return
+    for lostSequenceNumber in unacknowledgedPackets[serialIndex].keys():
+        if lostSequenceNumber == sequenceNumber:
+            break
+        resendLostPacket(serialIndex, lostSequenceNumber)
+    messageList, deadline = unacknowledgedPackets[serialIndex].pop(sequenceNumber)
+    for index, message in enumerate(messageList):
+        if appliedMessages & (1 << (index + 1)) and coalescingKey(message.split(",")) is not None:
+            updateCache(serialIndex, message + "&")
+            sendSerialPacketOverUDP(serialIndex, message + "&")
+    if not unacknowledgedPackets[serialIndex] and awaitedReplies[serialIndex] > 0:
+        # the acknowledgement is sent after the replies, so a reply that failed its
+        # checksum doesn't have to be waited for until serialReplyTimeout
+        awaitedReplies[serialIndex] = 0
+        serialReadTimes[serialIndex] = time.time() + serialLoopTime
+
+#-----
+# Sends the messages of a lost packet again. A message that changes a state is only
+# sent again if no later message overwrites it, and it is put before the pending
+# messages so that it can't overwrite them. Requests are sent again unless they are
+# already pending.
+def resendLostPacket(serialIndex, sequenceNumber):
+    global pendingMessageCounter
+    global resentMessageCount
+    messageList, deadline = unacknowledgedPackets[serialIndex].pop(sequenceNumber)
+    laterKeys = [key for (key, message) in pendingMessageList[serialIndex].values()]
+    for laterMessageList, laterDeadline in unacknowledgedPackets[serialIndex].values():
+        laterKeys += [coalescingKey(message.split(",")) for message in laterMessageList]
+    laterKeys = [key for key in laterKeys if key is not None]
+    resentMessages = OrderedDict()
+    for message in messageList:
+        key = coalescingKey(message.split(","))
+        if key is not None:
+            # it was counted when it was sent, and it will be counted again
+            if unechoedWrites[serialIndex] > 0:
+                unechoedWrites[serialIndex] -= 1
+            if any(overwritesMessage(laterKey, key) for laterKey in laterKeys):
+                continue
+        elif (None, message) in pendingMessageList[serialIndex].values() \
+            or (None, message) in resentMessages.values():
+            continue
+        pendingMessageCounter = pendingMessageCounter + 1
+        resentMessages[pendingMessageCounter] = (key, message)
+        resentMessageCount = resentMessageCount + 1
+    resentMessages.update(pendingMessageList[serialIndex])
+    pendingMessageList[serialIndex] = resentMessages
+
+#-----
+# Gives up on the packets of a serial device that weren't acknowledged within
+# serialReplyTimeout of being sent, and sends their messages again.
+def expireUnacknowledgedPackets(serialIndex):
+    now = time.time()
+    for sequenceNumber, (messageList, deadline) in unacknowledgedPackets[serialIndex].items():
+        if deadline > now:
+            return
+        resendLostPacket(serialIndex, sequenceNumber)
+
+#-----
+# Counts a packet from a serial device that replies to a request. Once the last reply
+# has arrived, the arduino reads its next packet after serialLoopTime.
+def receivedSerialReply(serialIndex, packet):
+    if awaitedReplies[serialIndex] == 0:
+        return
+    header = packet.split(",")[0]
+    if header in [str(stateUpdatePacketHeader),
+                  str(customColorUpdatePacketHeader),
+                  str(HostRenderer.deltaStateUpdatePacketHeader)]:
+        awaitedReplies[serialIndex] -= 1
+        if awaitedReplies[serialIndex] == 0:
+            serialReadTimes[serialIndex] = time.time() + serialLoopTime
+
+#-----
+# take pending messages, turn them into proper serial messages, then queue them
+# for the serial device. A serial device only gets a new packet once its link has
+# had time to send the previous one and the arduino can read it without overflowing
+# its receive buffer, so messages wait as pending messages where newer messages can
+# still overwrite them. Messages that don't fit in one packet are sent in the
+# following packets.
 def writeSerialMessages():
+    now = time.time()
     for x in range(0, numOfSerialDevices):
-        if (len(messageDict[x])):
-            message = convertMessageListToPacket(messageDict[x], x)
-            serialDevices[x].write(message)
-
-#-----
-# Takes a serial port as an argument, reads all available
-# characters, then echoes them on UDP
-def echoSerial(serialPort, serialIndex):
-    message = readSerialPort(serialPort)
-    if message != '':
-        # strip off the delimiting character
-        message = message.rstrip()[:-1]
-        # split into individual packets
-        messageSplitArray = message.split(";")
-        for message in messageSplitArray:
-            messageNoCRC, passedCRC = checkCRC(message)
-            # if serial device count is larger than zero, rewrite hardware index
-            if (passedCRC):
-                #print "ARDUINO: %r " % (message)
-                if (numOfSerialDevices > 1):
-                    messageArray = convertMultiCastPackets(message, serialIndex)
-                    for multiCastMessage in messageArray:
-                        if (len(multiCastMessage) > 1):
-                            sock.sendto(multiCastMessage, (addr[0], UDP_PORT))
-                else:
-                    if (len(message) > 1):
-                        sock.sendto(message, (addr[0], UDP_PORT))
+        if not isDiscovered(x):
+            continue
+        expireUnacknowledgedPackets(x)
+        if nextWriteTime(x) > now:
+            continue
+        if (len(pendingMessageList[x])):
+            messageList = takePendingMessages(x)
+            if messageList and sequenceSupportList[x]:
+                writeSequencedPacket(x, messageList)
+            elif messageList:
+                writeSerialPacket(x, messageList)
+        elif renderOnHost:
+            if not frameMessageList[x]:
+                renderFrame(x)
+            if frameMessageList[x]:
+                messageList = takeFrameMessages(x)
+                if messageList:
+                    writeSerialPacket(x, messageList)
+
+#-----
+# seconds until the next serial device with pending messages can send them, or
+# until the oldest unacknowledged packet is lost, or None if there are neither.
+def secondsUntilNextWrite():
+    timeout = None
+    now = time.time()
+    for x in range(0, numOfSerialDevices):
+        if isDiscovered(x) and len(pendingMessageList[x]):
+            wait = max(0.0, nextWriteTime(x) - now)
+            if timeout is None or wait < timeout:
+                timeout = wait
+        if isDiscovered(x) and unacknowledgedPackets[x]:
+            wait = max(0.0, unacknowledgedPackets[x].values()[0][1] - now)
+            if timeout is None or wait < timeout:
+                timeout = wait
+    return timeout
+
+#-----
+# Adds a packet to a serial device's write queue and writes as much of the queue
+# as the device will take without blocking. If the queue is full, its oldest
+# packet is dropped.
+def queueSerialPacket(serialIndex, packet):
+    global droppedPacketCount
+    if len(writeQueueList[serialIndex]) == maxWriteQueueSize:
+        droppedPacketCount = droppedPacketCount + 1
+    writeQueueList[serialIndex].append(packet)
+    flushSerialQueue(serialIndex)
+
+#-----
+# writes queued packets to a serial device until the queue is empty or the
+# device stops accepting bytes. A packet that is partially written is kept
+# separately so that dropping packets never splits one.
+def flushSerialQueue(serialIndex):
+    if serialDevices[serialIndex] is None:
+        return
+    fileDescriptor = serialDevices[serialIndex].fileno()
+    while pendingWriteList[serialIndex] or writeQueueList[serialIndex]:
+        if not pendingWriteList[serialIndex]:
+            pendingWriteList[serialIndex] = writeQueueList[serialIndex].popleft()
+        try:
+            written = os.write(fileDescriptor, pendingWriteList[serialIndex])
+        except OSError as error:
+            if error.errno in [errno.EAGAIN, errno.EWOULDBLOCK]:
+                return
+            disconnectSerialDevice(serialIndex)
+            return
+        pendingWriteList[serialIndex] = pendingWriteList[serialIndex][written:]
+
+#-----
+# the serial ports that have bytes waiting to be written
+def serialPortsWithQueuedWrites():
+    ports = []
+    for x in range(0, numOfSerialDevices):
+        if serialDevices[x] is not None and (pendingWriteList[x] or writeQueueList[x]):
+            ports.append(serialDevices[x])
+    return ports
+
+#-----
+# Reads all available characters from a serial device and returns the packets
+# that have fully arrived, without their ";". Anything after the last ";" is
+# kept until the rest of it arrives.
+def readSerialPackets(serialIndex):
+    try:
+        readBufferList[serialIndex] += readSerialPort(serialDevices[serialIndex])
+    except (serial.serialutil.SerialException, OSError):
+        # an unplugged device is reported as readable, but reading it fails
+        disconnectSerialDevice(serialIndex)
+        return []
+    packets = readBufferList[serialIndex].split(";")
+    readBufferList[serialIndex] = packets.pop()[-maxReadBufferSize:]
+    return [packet.strip() for packet in packets if packet.strip()]
+
+#-----
+# Takes a serial device index as an argument, reads all available
+# packets, then echoes them on UDP. Replies to polls from this script
+# only update the cache, and acknowledgements echo the messages they applied.
+def echoSerial(serialIndex):
+    for message in readSerialPackets(serialIndex):
+        messageNoCRC, passedCRC = checkCRC(message, checksumTypeList[serialIndex])
+        if (passedCRC):
+            #print "ARDUINO: %r " % (message)
+            if messageNoCRC.split(",")[0] == str(sequenceNumberPacketHeader):
+                acknowledgePacket(serialIndex, messageNoCRC)
+                continue
+            receivedSerialReply(serialIndex, messageNoCRC)
+            if not updateCache(serialIndex, messageNoCRC):
+                sendSerialPacketOverUDP(serialIndex, messageNoCRC)
+
+#-----
+# Sends a packet from a serial device, without its checksum, to the UDP clients subscribed
+# to its lighting devices, or to the given client addresses. The packet is encoded once
+# and the same datagram is sent to every client.
+def sendSerialPacketOverUDP(serialIndex, messageNoCRC, clients=None):
+    if clients is None:
+        clients = subscribedClientsForPacket(serialIndex, messageNoCRC)
+        if not clients:
+            return
+    # if serial device count is larger than zero, rewrite hardware index
+    if (numOfSerialDevices > 1):
+        messageArray = convertMultiCastPackets(messageNoCRC, serialIndex)
+    else:
+        # the serial checksum may differ from the UDP checksum, so replace it
+        messageArray = [appendCRC(messageNoCRC, udpChecksumType())]
+    for message in messageArray:
+        if (len(message) > 1):
+            for client in clients:
+                sock.sendto(message, (client, UDP_PORT))
 
 
 #-----
@@ -397,6 +1348,93 @@ def readSerialPort(serialPort):
         message += charReturned
     return message
 
+#--------------------------------
+# UDP Functions
+#--------------------------------
+
+#-----
+# the hardware indices that the messages of a packet from a UDP client are for. Requests
+# are answered for every lighting device, so they count as hardware index 0.
+def hardwareIndicesForPacket(packet):
+    hardwareIndices = set()
+    for message in packet.split("&"):
+        values = message.split(",")
+        if values[0] in ['', str(stateUpdatePacketHeader), str(customColorUpdatePacketHeader)] \
+            or len(values) < 2 or not values[1].isdigit():
+            if values[0] != '':
+                hardwareIndices.add(0)
+        else:
+            hardwareIndices.add(int(values[1]))
+    return hardwareIndices
+
+#-----
+# Renews the lease of a UDP client and subscribes it to packets from the given hardware
+# indices. Hardware index 0 subscribes it to every lighting device.
+def subscribeClient(client, hardwareIndices):
+    clientLeaseTimes[client] = time.time() + clientLeaseTime
+    for hardwareIndex in hardwareIndices:
+        if hardwareIndex not in subscribedClients:
+            subscribedClients[hardwareIndex] = set()
+        subscribedClients[hardwareIndex].add(client)
+
+#-----
+# Unsubscribes the UDP clients that haven't sent a packet for clientLeaseTime.
+def expireClientLeases():
+    global nextLeaseCheckTime
+    now = time.time()
+    if now < nextLeaseCheckTime:
+        return
+    nextLeaseCheckTime = now + clientLeaseCheckInterval
+    for client, leaseTime in clientLeaseTimes.items():
+        if leaseTime < now:
+            del clientLeaseTimes[client]
+            for clients in subscribedClients.values():
+                clients.discard(client)
+
+#-----
+# the addresses of the UDP clients subscribed to any of the lighting devices that a packet
+# from a serial device, without its checksum, is from.
+def subscribedClientsForPacket(serialIndex, messageNoCRC):
+    clients = set(subscribedClients.get(0, ()))
+    for message in messageNoCRC.split("&"):
+        values = message.split(",")
+        if len(values) > 1 and values[1].isdigit():
+            hardwareIndex = int(values[1])
+            if hardwareIndex == 0:
+                for lightIndex in lightHardwareIndices[serialIndex]:
+                    clients.update(subscribedClients.get(lightIndex, ()))
+            else:
+                clients.update(subscribedClients.get(hardwareIndex, ()))
+    return clients
+
+#-----
+# Reads a single datagram from the UDP socket and forwards it to the serial devices.
+def readUDPPacket():
+    global addr
+    try:
+        udp_data, addr = sock.recvfrom(512)
+    except socket.error as error:
+        if error.errno in [errno.EAGAIN, errno.EWOULDBLOCK]:
+            return
+        raise
+    #print "UDP: %r from %r" % (udp_data, addr)
+    if udp_data:
+        # discovery packets are special case, the relevant info from
+        # discovery packets are stored in this script already, so instead
+        # send back over UDP the stored discoveryPacket string
+        if checkIfDiscoveryPacket(udp_data):
+            subscribeClient(addr[0], [0])
+            sock.sendto(discoveryPacket, (addr[0], UDP_PORT))
+        else:
+            # checks a CRC and strips its information out of the packet
+            # if it is not using CRC, this function just returns the packet
+            # as is, and returns passedCRC as True
+            message, passedCRC = checkCRC(udp_data, udpChecksumType())
+            if (passedCRC or checkIfDiscoveryPacket(message)):
+                subscribeClient(addr[0], hardwareIndicesForPacket(message))
+                # sort messages into the pending messages of each serial device
+                sortMessages(message)
+
 #--------------------------------
 # Setup Connections and Variables
 #--------------------------------
@@ -415,18 +1453,75 @@ if (len(sys.argv) < 2):
 # configure the serial connections (the parameters differs on the device you are connecting to)
 print "Setup Serial..."
 serialDevices = []
-for x in range(1, len(sys.argv)):
-    try:
-        # a timeout of 0 makes serial.read nonblocking
-        serialDevices.append(serial.Serial(sys.argv[x], 9600, timeout=0.0))
-    except serial.serialutil.SerialException:
-        print "ERROR: Could not connect to serial device at: " + str(sys.argv[x])
+# the path of each serial device, used to reopen it after it is unplugged
+serialPaths = sys.argv[1:]
+for path in serialPaths:
+    serialPort = openSerialPort(path)
+    if serialPort is None:
+        print "ERROR: Could not connect to serial device at: " + str(path)
         sys.exit()
+    serialDevices.append(serialPort)
 numOfSerialDevices = len(serialDevices)
 
 #-----------------------------
 lightHardwareIndices = [[] for i in xrange(numOfSerialDevices)]
-messageDict = {k: [] for k in range(numOfSerialDevices)}
+# messages waiting to be sent to each serial device, in the order they arrived
+pendingMessageList = [OrderedDict() for i in xrange(numOfSerialDevices)]
+# counts pending messages so each gets a unique key
+pendingMessageCounter = 0
+# pending messages removed because a newer message overwrote them
+coalescedMessageCount = 0
+# time when each serial device's link is done sending its last packet
+linkFreeTimes = [0 for i in xrange(numOfSerialDevices)]
+# time each arduino is expected to read its serial port again
+serialReadTimes = [0 for i in xrange(numOfSerialDevices)]
+# replies to requests that each serial device hasn't sent yet, and the time to stop waiting for them
+awaitedReplies = [0 for i in xrange(numOfSerialDevices)]
+replyDeadlines = [0 for i in xrange(numOfSerialDevices)]
+# True for serial devices that acknowledge packets with a sequence number
+sequenceSupportList = [False for i in xrange(numOfSerialDevices)]
+# sequence number of the next packet sent to each serial device
+nextSequenceNumbers = [0 for i in xrange(numOfSerialDevices)]
+# packets that are waiting for their acknowledgement, sequence number -> (messages, the
+# time the packet is lost if it isn't acknowledged), in the order they were sent
+unacknowledgedPackets = [OrderedDict() for i in xrange(numOfSerialDevices)]
+# number of messages sent again because their packet was lost
+resentMessageCount = 0
+# the last state update and custom array update messages from each serial device,
+# stored by hardware index
+stateUpdateCache = [{} for i in xrange(numOfSerialDevices)]
+customArrayUpdateCache = [{} for i in xrange(numOfSerialDevices)]
+# time each cache was last updated by its serial device, for each header
+cacheUpdateTimes = [{stateUpdatePacketHeader: 0, customColorUpdatePacketHeader: 0} for i in xrange(numOfSerialDevices)]
+# time the last message that changes a state was sent to each serial device
+lastWriteTimes = [0 for i in xrange(numOfSerialDevices)]
+# messages that change a state that were sent to each serial device but not echoed yet
+unechoedWrites = [0 for i in xrange(numOfSerialDevices)]
+# time a UDP client last asked for a state update or custom array update
+lastUpdateRequestTime = 0
+# time each serial device was last polled for its updates
+lastPollTimes = [0 for i in xrange(numOfSerialDevices)]
+# replies to polls that haven't arrived yet, for each serial device and header
+unansweredPolls = [{stateUpdatePacketHeader: 0, customColorUpdatePacketHeader: 0} for i in xrange(numOfSerialDevices)]
+# packets waiting to be written to each serial device
+writeQueueList = [deque(maxlen=maxWriteQueueSize) for i in xrange(numOfSerialDevices)]
+# the unwritten end of the packet currently being written to each serial device
+pendingWriteList = ['' for i in xrange(numOfSerialDevices)]
+# characters read from each serial device that aren't a full packet yet
+readBufferList = ['' for i in xrange(numOfSerialDevices)]
+# packets dropped because a serial device's write queue was full
+droppedPacketCount = 0
+# counts the messages that were too long for a serial device's max packet size
+oversizedMessageCount = 0
+# the lighting devices of each serial device, if they are rendered by this script
+renderedDevices = [[] for i in xrange(numOfSerialDevices)]
+# frame update messages waiting to be sent to each serial device
+frameMessageList = [deque() for i in xrange(numOfSerialDevices)]
+# time each serial device was last sent a frame, and last sent a full frame
+lastFrameTimes = [0 for i in xrange(numOfSerialDevices)]
+lastRefreshTimes = [0 for i in xrange(numOfSerialDevices)]
+# frames rendered that changed at least one LED
+sentFrameCount = 0
 #-----------------------------
 
 
@@ -439,12 +1534,22 @@ discoveryPacket = None
 majorAPILevel = None
 minorAPILevel = None
 udp_data = None
+# address of the UDP client that sent the last packet
 addr = None
-nameList = []
-typeList = []
-productList = []
+# address of each UDP client and the time its lease ends
+clientLeaseTimes = {}
+# hardware index -> addresses of the UDP clients subscribed to it. Clients subscribed to
+# hardware index 0 get the packets of every lighting device.
+subscribedClients = {}
+nextLeaseCheckTime = 0
+nextSerialDeviceCheckTime = 0
+nameList = [[] for i in xrange(numOfSerialDevices)]
+typeList = [[] for i in xrange(numOfSerialDevices)]
+productList = [[] for i in xrange(numOfSerialDevices)]
 # this list is used to store the max packet size for each serial device.
 maxPacketSizeList = [0 for i in xrange(numOfSerialDevices)]
+# this list stores the checksum negotiated with each serial device.
+checksumTypeList = [checksumCRC32 for i in xrange(numOfSerialDevices)]
 # set this to define the max packet size sent to the server. The server will
 # simplify packets and only send relevant information to different arduinos,
 # so it can accept a larger packet size.
@@ -456,36 +1561,39 @@ maxPacketSizeServer = 250
 #--------------------------------
 
 # First, check that a serial stream can be successfully used by sending discovery
-# packets to the connetctd serial devices
-serialDiscoveryFlags = [False for i in xrange(numOfSerialDevices)]
-fullyDiscoveredFlags  = [False for i in xrange(numOfSerialDevices)]
-index = 0
-while not all(fullyDiscoveredFlags):
-    # first send discovery packets and find devices
-    if not serialDiscoveryFlags[index]:
-        serialDevices[index].write("DISCOVERY_PACKET;")
-        serialDiscoveryFlags[index] = readForDiscovery(serialDevices[index], index)
-    else:
-        # once a serial device is discovered, send state update packets and
-        # parse responses to find the hardware indices associated with the serial
-        # device.
-        serialDevices[index].write(stateUpdatePacket())
-        fullyDiscoveredFlags[index] = parseStateUpdateForHardwareIndices(serialDevices[index], index)
-        if fullyDiscoveredFlags[index]:
-            print "Serial Device #" + str(index) + " found with lighting devices " + str(lightHardwareIndices[index])
-            index = index + 1 # move on to the next index
-    time.sleep(0.1)
-
-# get max hardware index
-maxIndex = -1
-for serialDeviceNumbers in lightHardwareIndices:
-    for lightIndex in serialDeviceNumbers:
-        if lightIndex > maxIndex:
-            maxIndex = lightIndex
-deviceCount = maxIndex
-
-# create a discovery packet
-discoveryPacket = buildDiscoveryPacket()
+# packets to the connetctd serial devices. All devices are discovered at the same time,
+# each one moving to its next stage as soon as it replies.
+discoveryStageList = [discoveryStageSearching for i in xrange(numOfSerialDevices)]
+discoveryRequestTimes = [0 for i in xrange(numOfSerialDevices)]
+# number of times to ask a device to switch checksums before falling back to CRC-32
+maxChecksumSelectionAttempts = 5
+checksumSelectionAttempts = [0 for i in xrange(numOfSerialDevices)]
+for x in range(0, numOfSerialDevices):
+    sendDiscoveryRequest(x)
+while any(isDiscovering(x) for x in range(0, numOfSerialDevices)):
+    readable, writable, exceptional = select.select(connectedSerialPorts(),
+                                                    serialPortsWithQueuedWrites(),
+                                                    [],
+                                                    discoveryRetryInterval)
+    for serialPort in writable:
+        if serialPort in serialDevices:
+            flushSerialQueue(serialDevices.index(serialPort))
+    for serialPort in readable:
+        if serialPort in serialDevices:
+            serialIndex = serialDevices.index(serialPort)
+            for packet in readSerialPackets(serialIndex):
+                handleDiscoveryReply(serialIndex, packet)
+    retryDiscoveryRequests()
+
+# map each hardware index to its serial device and create a discovery packet
+mapHardwareIndices()
+
+# render the routines of every lighting device that was discovered
+if renderOnHost:
+    renderLibrary = HostRenderer.loadLibrary()
+    HostRenderer.frameCacheSize = renderFrameCacheSize
+    for x in range(0, numOfSerialDevices):
+        createRenderedDevices(x)
 
 if deviceCount == 1:
     print "Serial stream confirmed with " + str(deviceCount) + " device."
@@ -497,6 +1605,8 @@ print "Setup the UDP Socket..."
 # set up UDP server.
 sock = socket.socket(socket.AF_INET,    # Internet
                      socket.SOCK_DGRAM) # UDP
+# lets clients on this computer, such as LoadGenerator.py, bind UDP_PORT on their own loopback address
+sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
 sock.bind(("", UDP_PORT))
 sock.settimeout(0.02)
 
@@ -511,38 +1621,50 @@ while not receivedUDP:
         pass
 
 print "UDP packet received!"
+# the first UDP client is subscribed to every lighting device
+subscribeClient(addr[0], [0])
 
 #--------------------------------
 # Main loop
 #--------------------------------
 
 print "Starting main loop..."
-# Once a serial stream has been estbalished, repeat this ad nauseam
+sock.setblocking(0)
+# Once a serial stream has been estbalished, repeat this ad nauseam. Wait until
+# the socket or a serial port has data, a serial port with queued packets can
+# take more bytes, or a serial link is free to send pending messages or the next
+# rendered frame. Wake up at least every writeSettleTime to poll serial devices for
+# their updates, and in time to check for unplugged serial devices and retry the
+# discovery of serial devices that were plugged back in.
 while True:
-    try:
-        # waits to receive data
-        udp_data, addr = sock.recvfrom(512)
-        #print "UDP: %r from %r" % (udp_data, addr)
-        if udp_data:
-            # discovery packets are special case, the relevant info from
-            # discovery packets are stored in this script already, so instead
-            # send back over UDP the stored discoveryPacket string
-            if checkIfDiscoveryPacket(udp_data):
-                sock.sendto(discoveryPacket, (addr[0], UDP_PORT))
+    timeout = secondsUntilNextWrite()
+    if renderOnHost:
+        frameTimeout = secondsUntilNextFrame()
+        if timeout is None or frameTimeout < timeout:
+            timeout = frameTimeout
+    if timeout is None or timeout > writeSettleTime:
+        timeout = writeSettleTime
+    timeout = min(timeout, secondsUntilNextSerialDeviceCheck())
+    readable, writable, exceptional = select.select([sock] + connectedSerialPorts(),
+                                                    serialPortsWithQueuedWrites(),
+                                                    [],
+                                                    timeout)
+    # a serial device can be disconnected by an earlier read or write in this loop
+    for serialPort in writable:
+        if serialPort in serialDevices:
+            flushSerialQueue(serialDevices.index(serialPort))
+    for ready in readable:
+        if ready is sock:
+            readUDPPacket()
+        elif ready in serialDevices:
+            serialIndex = serialDevices.index(ready)
+            if isDiscovering(serialIndex):
+                readDiscoveryReplies(serialIndex)
             else:
-                messageDict = {k: [] for k in range(numOfSerialDevices)}
-                # checks a CRC and strips its information out of the packet
-                # if it is not using CRC, this function just returns the packet
-                # as is, and returns passedCRC as True
-                message, passedCRC = checkCRC(udp_data)
-                if (passedCRC or checkIfDiscoveryPacket(message)):
-                    # sort messages into a dictionary where the serial devices are used as keys
-                    sortMessages(message)
-                    # parse the dictionary and send messages to the proper serial devices.
-                    writeSerialMessages()
-        # loop through all serial devices
-        for x in range(0, numOfSerialDevices):
-            # check for serial packets and echo if needed
-            echoSerial(serialDevices[x], x)
-    except socket.timeout:
-        pass
+                # check for serial packets and echo if needed
+                echoSerial(serialIndex)
+    checkSerialDevices()
+    retryDiscoveryRequests()
+    expireClientLeases()
+    pollSerialDevices()
+    writeSerialMessages()
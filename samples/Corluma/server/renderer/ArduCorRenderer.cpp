@@ -0,0 +1,169 @@
+/*!
+ * \file ArduCorRenderer.cpp
+ * \author Tim Seemann
+ * \copyright <a href="https://github.com/timsee/ArduCor/blob/master/LICENSE">
+ *            MIT License
+ *            </a>
+ *
+ * A C interface to the ArduCor library, so that UDPtoSerialAdapter.py can render the
+ * lighting routines itself and send the arduinos finished frames. Build it from this
+ * folder with:
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~
+ * g++ -O2 -shared -fPIC -I. -I../../../../ArduCor ArduCorRenderer.cpp ../../../../ArduCor/ArduCor.cpp -o libArduCorRenderer.so
+ * ~~~~~~~~~~~~~~~~~~~~~
+ *
+ * The local Arduino.h is found before any Arduino core, so the library builds as plain C++.
+ */
+#include "ArduCor.h"
+
+extern "C" {
+
+ArduCor* arducorCreate(uint16_t ledCount)
+{
+    return new ArduCor(ledCount);
+}
+
+void arducorDestroy(ArduCor* routines)
+{
+    delete routines;
+}
+
+/*!
+ * Lets routines keep the frames of periodic routines in up to maxBytes, see ArduCor::frameCache.
+ */
+void arducorSetFrameCache(ArduCor* routines, uint32_t maxBytes)
+{
+    routines->frameCache(maxBytes);
+}
+
+/*!
+ * Makes routines continue from the state of other, see ArduCor::copyState.
+ */
+bool arducorCopyState(ArduCor* routines, ArduCor* other)
+{
+    return routines->copyState(*other);
+}
+
+bool arducorHasSameState(ArduCor* routines, ArduCor* other)
+{
+    return routines->hasSameState(*other);
+}
+
+void arducorTurnOn(ArduCor* routines)
+{
+    routines->turnOn();
+}
+
+void arducorTurnOff(ArduCor* routines)
+{
+    routines->turnOff();
+}
+
+bool arducorIsOn(ArduCor* routines)
+{
+    return routines->isOn();
+}
+
+bool arducorSetMainColor(ArduCor* routines, uint8_t red, uint8_t green, uint8_t blue)
+{
+    return routines->setMainColor(red, green, blue);
+}
+
+void arducorSetColor(ArduCor* routines, uint16_t colorIndex, uint8_t red, uint8_t green, uint8_t blue)
+{
+    routines->setColor(colorIndex, red, green, blue);
+}
+
+void arducorSetCustomColorCount(ArduCor* routines, uint8_t count)
+{
+    routines->setCustomColorCount(count);
+}
+
+uint8_t arducorCustomColorCount(ArduCor* routines)
+{
+    return routines->customColorCount();
+}
+
+void arducorSetBrightness(ArduCor* routines, uint8_t brightness)
+{
+    routines->brightness(brightness);
+}
+
+int arducorBrightness(ArduCor* routines)
+{
+    return routines->brightness();
+}
+
+/*!
+ * Fills color with the red, green, and blue of the main color when colorIndex is -1, or
+ * of the custom color at colorIndex otherwise.
+ */
+void arducorColor(ArduCor* routines, int colorIndex, uint8_t* color)
+{
+    ArduCor::Color value = (colorIndex < 0) ? routines->mainColor() : routines->color(colorIndex);
+    color[0] = value.red;
+    color[1] = value.green;
+    color[2] = value.blue;
+}
+
+/*!
+ * Runs one update of a routine and applies the brightness, the same way the changeRoutine
+ * function of the Corluma sample sketches does. param is the glimmer percent, the bar size,
+ * or the fade or sawtooth option, depending on the routine.
+ */
+void arducorUpdateRoutine(ArduCor* routines, int routine, int palette, int param)
+{
+    ArduCor::Color color = routines->mainColor();
+    switch ((ERoutine)routine)
+    {
+        case eSingleSolid:
+            routines->singleSolid(color.red, color.green, color.blue);
+            break;
+        case eSingleBlink:
+            routines->singleBlink(color.red, color.green, color.blue);
+            break;
+        case eSingleWave:
+            routines->singleWave(color.red, color.green, color.blue);
+            break;
+        case eSingleGlimmer:
+            routines->singleGlimmer(color.red, color.green, color.blue, param);
+            break;
+        case eSingleFade:
+            routines->singleFade(color.red, color.green, color.blue, param);
+            break;
+        case eSingleSawtoothFade:
+            routines->singleSawtoothFade(color.red, color.green, color.blue, param);
+            break;
+        case eMultiGlimmer:
+            routines->multiGlimmer((EPalette)palette, param);
+            break;
+        case eMultiFade:
+            routines->multiFade((EPalette)palette);
+            break;
+        case eMultiRandomSolid:
+            routines->multiRandomSolid((EPalette)palette);
+            break;
+        case eMultiRandomIndividual:
+            routines->multiRandomIndividual((EPalette)palette);
+            break;
+        case eMultiBars:
+            routines->multiBars((EPalette)palette, param);
+            break;
+        default:
+            break;
+    }
+    routines->applyBrightness();
+}
+
+/*!
+ * Copies the LEDs as they would be shown into frame, three bytes per LED in red, green,
+ * blue order. LEDs are all 0 while the routines are turned off.
+ */
+void arducorReadFrame(ArduCor* routines, uint16_t ledCount, uint8_t* frame)
+{
+    // a Color is three bytes in red, green, blue order, the same as the frame
+    routines->pixelColors(0, ledCount, (ArduCor::Color*)frame);
+}
+
+}
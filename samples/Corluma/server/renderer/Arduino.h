@@ -0,0 +1,34 @@
+/*!
+ * \file Arduino.h
+ * \author Tim Seemann
+ * \copyright <a href="https://github.com/timsee/ArduCor/blob/master/LICENSE">
+ *            MIT License
+ *            </a>
+ *
+ * The parts of the Arduino core that the ArduCor library uses, so that the library can
+ * be built for the computer running UDPtoSerialAdapter.py.
+ */
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "avr/pgmspace.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+/*!
+ * Returns a random number from min up to but not including max, like the Arduino function.
+ */
+inline long random(long min, long max)
+{
+    if (max <= min) {
+        return min;
+    }
+    return min + (rand() % (max - min));
+}
+
+#endif // Arduino_h
@@ -0,0 +1,20 @@
+/*!
+ * \file pgmspace.h
+ * \author Tim Seemann
+ * \copyright <a href="https://github.com/timsee/ArduCor/blob/master/LICENSE">
+ *            MIT License
+ *            </a>
+ *
+ * PROGMEM is ordinary memory on a computer, so reading from it is a plain dereference.
+ */
+#ifndef pgmspace_h
+#define pgmspace_h
+
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte_near(address) (*(address))
+#define pgm_read_word_near(address) (*(address))
+#define memcpy_P memcpy
+
+#endif // pgmspace_h